@@ -0,0 +1,213 @@
+#include "actorcache.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+uint64_t windowHash(const cv::Mat& window) {
+  auto small = cv::Mat{};
+  cv::resize(window, small, cv::Size{9, 8}, 0, 0, cv::INTER_AREA);
+
+  uint64_t hash = 0;
+  for (int y = 0; y < small.rows; y++) {
+    auto row = small.ptr<uint8_t>(y);
+    for (int x = 0; x < small.cols - 1; x++) {
+      hash = (hash << 1) | (row[x] > row[x + 1] ? 1 : 0);
+    }
+  }
+  return hash;
+}
+
+namespace {
+
+// Bump when a change to the recognizers changes the answers they give
+const int kCacheFormat = 2;
+const char* const kCacheMagic = "jerkcity-actor-cache";
+
+}  // namespace
+
+uint64_t actorTemplatesHash(const Models& models) {
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325;
+  auto add = [&](const void* data, size_t size) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+  };
+  for (const auto& actor : models.actors) {
+    add(actor.name.data(), actor.name.size() + 1);
+    const int size[] = {actor.img.rows, actor.img.cols};
+    add(size, sizeof(size));
+    for (int y = 0; y < actor.img.rows; y++) {
+      add(actor.img.ptr<uint8_t>(y), actor.img.cols);
+    }
+  }
+  return hash;
+}
+
+ActorCache::ActorCache(int radius_, size_t capacity_)
+    : radius{radius_}, capacity{capacity_} {
+  ASSERT(capacity > 0);
+  entries.reserve(capacity);
+}
+
+// A header line naming the format and the templates hash, then one entry per
+// line: engine, hash in hex, actor
+bool ActorCache::load(const std::string& file, uint64_t templates) {
+  std::ifstream fin{file};
+  if (!fin) {
+    return true;
+  }
+
+  std::string line;
+  std::getline(fin, line);
+  auto header = std::istringstream{line};
+  auto magic = std::string{};
+  auto format = 0;
+  uint64_t savedTemplates = 0;
+  if (!(header >> magic >> format >> std::hex >> savedTemplates) ||
+      magic != kCacheMagic || format != kCacheFormat ||
+      savedTemplates != templates) {
+    return false;
+  }
+
+  std::lock_guard<std::shared_timed_mutex> lock{mutex};
+  while (std::getline(fin, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    auto in = std::istringstream{line};
+    auto engine = std::string{};
+    auto entry = Entry{};
+    if (!(in >> engine >> std::hex >> entry.hash >> std::ws) ||
+        !std::getline(in, entry.actor)) {
+      throw std::runtime_error{"Bad actor cache entry in " + file + ": " +
+                               line};
+    }
+    entry.engine = parseActorEngine(engine);
+    insertLocked(std::move(entry));
+  }
+  return true;
+}
+
+void ActorCache::save(const std::string& file, uint64_t templates) const {
+  std::ofstream fout{file};
+  if (!fout) {
+    throw std::runtime_error{"Couldn't write actor cache: " + file};
+  }
+
+  fout << kCacheMagic << " " << kCacheFormat << " " << std::hex
+       << std::setfill('0') << std::setw(16) << templates << "\n";
+
+  // Oldest first, so that loading it back evicts the same entries
+  std::shared_lock<std::shared_timed_mutex> lock{mutex};
+  for (size_t i = 0; i < entries.size(); i++) {
+    const auto& entry = entries[(oldest + i) % entries.size()];
+    fout << actorEngineName(entry.engine) << " " << std::hex
+         << std::setfill('0') << std::setw(16) << entry.hash << " "
+         << entry.actor << "\n";
+  }
+}
+
+bool ActorCache::lookup(ActorEngine engine, uint64_t hash,
+                        std::string& outActor) {
+  auto start = std::chrono::steady_clock::now();
+  std::shared_lock<std::shared_timed_mutex> lock{mutex};
+
+  // The capacity keeps this to a few thousand entries, so a linear scan of
+  // popcounts is cheaper than anything cleverer
+  const Entry* best = nullptr;
+  auto bestDist = radius + 1;
+  for (const auto& entry : entries) {
+    auto dist = __builtin_popcountll(entry.hash ^ hash);
+    if (dist < bestDist && entry.engine == engine) {
+      best = &entry;
+      bestDist = dist;
+    }
+  }
+
+  if (best != nullptr) {
+    outActor = best->actor;
+    hits++;
+  } else {
+    misses++;
+  }
+  lookupNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  return best != nullptr;
+}
+
+void ActorCache::insert(ActorEngine engine, uint64_t hash,
+                        const std::string& actor) {
+  std::lock_guard<std::shared_timed_mutex> lock{mutex};
+  insertLocked(Entry{hash, engine, actor});
+}
+
+void ActorCache::insertLocked(Entry entry) {
+  for (const auto& existing : entries) {
+    if (existing.hash == entry.hash && existing.engine == entry.engine) {
+      return;
+    }
+  }
+  if (entries.size() < capacity) {
+    entries.push_back(std::move(entry));
+    return;
+  }
+  entries[oldest] = std::move(entry);
+  oldest = (oldest + 1) % capacity;
+  evictions++;
+}
+
+ActorCache::Stats ActorCache::stats() const {
+  std::shared_lock<std::shared_timed_mutex> lock{mutex};
+  auto result = Stats{};
+  result.entries = entries.size();
+  result.hits = hits;
+  result.misses = misses;
+  result.evictions = evictions;
+  result.lookupMs = lookupNs / 1e6;
+  return result;
+}
+
+namespace {
+
+class CachedActorRecognizer : public ActorRecognizer {
+ public:
+  CachedActorRecognizer(std::unique_ptr<ActorRecognizer> inner_,
+                        ActorEngine engine_, ActorCache& cache_,
+                        StatsRecorder& stats_)
+      : inner{std::move(inner_)},
+        engine{engine_},
+        cache(cache_),
+        stats(stats_) {}
+
+  std::string findActor(cv::Mat window) const override {
+    auto hash = windowHash(window);
+    auto actor = std::string{};
+    if (cache.lookup(engine, hash, actor)) {
+      stats.count("actorCacheHits");
+    } else {
+      stats.count("actorCacheMisses");
+      actor = inner->findActor(window);
+      cache.insert(engine, hash, actor);
+    }
+    return actor;
+  }
+
+ private:
+  std::unique_ptr<ActorRecognizer> inner;
+  ActorEngine engine;
+  ActorCache& cache;
+  StatsRecorder& stats;
+};
+
+}  // namespace
+
+std::unique_ptr<ActorRecognizer> makeCachedActorRecognizer(
+    std::unique_ptr<ActorRecognizer> inner, ActorEngine engine,
+    ActorCache& cache, StatsRecorder& stats) {
+  return std::unique_ptr<ActorRecognizer>{
+      new CachedActorRecognizer{std::move(inner), engine, cache, stats}};
+}
@@ -0,0 +1,85 @@
+#ifndef _ACTORCACHE_H_
+#define _ACTORCACHE_H_
+
+#include "actors.h"
+
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+
+// A 64 bit difference hash of an actor window: the window is shrunk to 9x8 and
+// each bit says whether a pixel is brighter than its right hand neighbour.
+// Windows cut out of different strips from the same character art hash to the
+// same value or a few bits apart.
+uint64_t windowHash(const cv::Mat& window);
+
+// Identifies the actor templates (names and pixels) a cache file's answers
+// came from
+uint64_t actorTemplatesHash(const Models& models);
+
+const size_t kDefaultActorCacheEntries = 4096;
+
+// Remembers which actor was found in windows seen before, keyed by windowHash()
+// and the engine that found it. A window whose hash is within `radius` bits of
+// a remembered one gets that answer without running the recognizer, so the
+// answers are approximate and, when shared between threads, depend on which
+// comic got there first. Holds at most `capacity` entries, dropping the oldest
+// to make room. Safe to share between threads; lookups only take a shared
+// lock.
+class ActorCache {
+ public:
+  ActorCache(int radius_, size_t capacity_ = kDefaultActorCacheEntries);
+
+  ActorCache(const ActorCache&) = delete;
+  ActorCache& operator=(const ActorCache&) = delete;
+
+  // Adds the entries in a file written by save(), as insert() would. A missing
+  // file is an empty cache. Returns false, adding nothing, if the file was
+  // saved with other actor templates (see actorTemplatesHash()) or by a
+  // version of jerkcity whose answers may differ.
+  bool load(const std::string& file, uint64_t templates);
+  void save(const std::string& file, uint64_t templates) const;
+
+  // The closest remembered answer within the radius, if there is one
+  bool lookup(ActorEngine engine, uint64_t hash, std::string& outActor);
+  // Does nothing if the hash is already there for the engine, which happens
+  // when two threads miss on the same window at once
+  void insert(ActorEngine engine, uint64_t hash, const std::string& actor);
+
+  struct Stats {
+    size_t entries = 0;
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    double lookupMs = 0;  // total time spent in lookup()
+  };
+  Stats stats() const;
+
+ private:
+  struct Entry {
+    uint64_t hash;
+    ActorEngine engine;
+    std::string actor;
+  };
+
+  void insertLocked(Entry entry);
+
+  const int radius;
+  const size_t capacity;
+  mutable std::shared_timed_mutex mutex;
+  // Filled in order, then used as a ring: `oldest` is the next to be replaced
+  std::vector<Entry> entries;
+  size_t oldest = 0;
+  size_t evictions = 0;  // guarded by the exclusive lock
+  std::atomic<size_t> hits{0};
+  std::atomic<size_t> misses{0};
+  std::atomic<int64_t> lookupNs{0};
+};
+
+// Answers from the cache where it can and asks `inner` otherwise, remembering
+// what it says. Hits and misses are also counted in `stats`.
+std::unique_ptr<ActorRecognizer> makeCachedActorRecognizer(
+    std::unique_ptr<ActorRecognizer> inner, ActorEngine engine,
+    ActorCache& cache, StatsRecorder& stats);
+
+#endif
@@ -1,8 +1,168 @@
-#include "context.h"
+#include "actors.h"
+#include "actorcache.h"
 
-std::string findActor(cv::Mat);
+#include <limits>
 
-void removeBg_Destructive(cv::Mat img) {
+double scoreActor(const ActorScoring& scoring,
+                  const std::vector<float>& distances,
+                  size_t templateDescriptors) {
+  if (distances.empty() || templateDescriptors == 0) {
+    return -1;
+  }
+
+  auto best = *std::min_element(distances.begin(), distances.end());
+  auto maxDist =
+      std::min(scoring.maxGoodDistance,
+               std::max(scoring.distanceRatio * best, scoring.minGoodDistance));
+
+  auto good = static_cast<size_t>(
+      std::count_if(distances.begin(), distances.end(),
+                    [maxDist](float d) { return d <= maxDist; }));
+  if (good < scoring.minGoodMatches) {
+    return -1;
+  }
+
+  auto score = (double)good / (double)templateDescriptors;
+  return score > scoring.minScore ? score : -1;
+}
+
+std::shared_ptr<const ActorIndex> buildActorIndex(
+    const std::vector<cv::Mat>& templateDescriptors,
+    const cv::flann::IndexParams& params, cvflann::flann_distance_t distance) {
+  auto result = std::make_shared<ActorIndex>();
+  result->squaredDistances = distance == cvflann::FLANN_DIST_L2;
+  for (size_t i = 0; i < templateDescriptors.size(); i++) {
+    const auto& descriptors = templateDescriptors[i];
+    result->counts.push_back(descriptors.rows);
+    if (descriptors.empty()) {
+      continue;
+    }
+    result->descriptors.push_back(descriptors);
+    result->labels.insert(result->labels.end(), descriptors.rows, i);
+  }
+  if (!result->descriptors.empty()) {
+    result->index = std::make_shared<cv::flann::Index>(result->descriptors,
+                                                       params, distance);
+  }
+  return result;
+}
+
+std::string voteForActor(const Models& models, const ActorIndex& actors,
+                         const cv::Mat& descriptors,
+                         const ActorScoring& scoring) {
+  // Enough neighbours that a window descriptor can vote for several poses (and
+  // both orientations) of the same actor
+  const int kNeighbours = 8;
+
+  if (descriptors.empty() || !actors.index) {
+    return "unknown";
+  }
+
+  auto k = std::min(kNeighbours, actors.descriptors.rows);
+  auto indices = cv::Mat{};
+  auto dists = cv::Mat{};
+  actors.index->knnSearch(descriptors, indices, dists, k,
+                          cv::flann::SearchParams{32});
+
+  // ActorScoring counts the template descriptors whose closest window
+  // descriptor is near enough. So each template descriptor that turned up as a
+  // neighbour is one match, at its closest distance to any window descriptor,
+  // however many window descriptors found it.
+  const auto kUnmatched = std::numeric_limits<float>::infinity();
+  std::vector<float> closest(actors.descriptors.rows, kUnmatched);
+  for (int q = 0; q < indices.rows; q++) {
+    for (int n = 0; n < k; n++) {
+      auto row = indices.at<int>(q, n);
+      if (row < 0) {
+        continue;
+      }
+      float dist = dists.type() == CV_32S ? dists.at<int>(q, n)
+                                          : dists.at<float>(q, n);
+      // FLANN reports squared L2 distances
+      if (actors.squaredDistances) {
+        dist = std::sqrt(dist);
+      }
+      closest[row] = std::min(closest[row], dist);
+    }
+  }
+
+  std::vector<std::vector<float>> votes(actors.counts.size());
+  for (size_t row = 0; row < closest.size(); row++) {
+    if (closest[row] != kUnmatched) {
+      votes[actors.labels[row]].push_back(closest[row]);
+    }
+  }
+
+  auto bestScore = -1.0;
+  const ActorTemplate* best = nullptr;
+  for (size_t i = 0; i < votes.size(); i++) {
+    auto score = scoreActor(scoring, votes[i], actors.counts[i]);
+    if (score > bestScore) {
+      bestScore = score;
+      best = &models.actors[i];
+    }
+  }
+
+  return best != nullptr ? best->name : "unknown";
+}
+
+ActorEngine parseActorEngine(const std::string& name) {
+  if (name == "sift") {
+    return ActorEngine::Sift;
+  }
+  if (name == "orb") {
+    return ActorEngine::Orb;
+  }
+  if (name == "sift-reference") {
+    return ActorEngine::SiftReference;
+  }
+  throw std::runtime_error{"Unknown actor engine: " + name};
+}
+
+std::string actorEngineName(ActorEngine engine) {
+  switch (engine) {
+    case ActorEngine::Sift:
+      return "sift";
+    case ActorEngine::Orb:
+      return "orb";
+    case ActorEngine::SiftReference:
+      return "sift-reference";
+  }
+  throw std::runtime_error{"Unknown actor engine"};
+}
+
+std::unique_ptr<ActorRecognizer> makeActorRecognizer(ActorEngine engine,
+                                                     const Models& models) {
+  switch (engine) {
+    case ActorEngine::Sift:
+      return makeSiftActorRecognizer(models);
+    case ActorEngine::Orb:
+      return makeOrbActorRecognizer(models);
+    case ActorEngine::SiftReference:
+      return makeReferenceSiftActorRecognizer(models);
+  }
+  throw std::runtime_error{"Unknown actor engine"};
+}
+
+cv::Rect actorWindow(cv::Point tip, cv::Size panelSize) {
+  const auto kWindowWidth = 128;
+  const auto kWindowYOffset = 16;
+
+  auto bounds = cv::Rect{std::max(0, tip.x - kWindowWidth / 2),
+                         std::min(panelSize.height - 1, tip.y + kWindowYOffset),
+                         0, 0};
+  bounds.width = std::min(panelSize.width - bounds.x, kWindowWidth);
+  bounds.height = panelSize.height - bounds.y;
+  ASSERT(bounds.x < panelSize.width);
+  ASSERT(bounds.y < panelSize.height);
+  ASSERT(bounds.y + bounds.height <= panelSize.height);
+  ASSERT(bounds.x + bounds.width <= panelSize.width);
+  return bounds;
+}
+
+// The original pixel by pixel removeBg_Destructive, which the one below must
+// match exactly
+void removeBg_Reference_Destructive(cv::Mat img) {
   for (int y = 0; y < img.rows; y++) {
     for (int x = 0; x < img.cols; x++) {
       auto val = img.at<uint8_t>(y, x);
@@ -30,8 +190,80 @@ void removeBg_Destructive(cv::Mat img) {
   }
 }
 
-bool tryFindBubbleSource_Destructive(cv::Mat img, cv::Rect bubbleBounds,
-                                     cv::Rect panelBounds, cv::Point& outPt) {
+// The reference visits every pixel in raster order and, for each one that is
+// neither black nor white, greys the window from two rows above to one row
+// below and two columns left to one right. In that window it greys black
+// pixels only on or above its own row, and whatever it greys counts as not
+// black once visited. Grey then becomes white. Worked through, that leaves
+//  - white pixels alone,
+//  - every other pixel that isn't black white,
+//  - a black pixel white iff there is a seed on its row or the two below it,
+//    from one column left of it to two right,
+// where a row's seeds are its pixels that are neither black nor white, plus
+// the black pixels they reach rightwards without crossing a white pixel.
+//
+// So this is a seed mask per row, dilated by a 4 wide row filter and a 3 high
+// column filter and applied to the black pixels, swept down the image with
+// the last three rows' filtered seeds in a ring.
+void removeBg_Destructive(cv::Mat img) {
+  const uint8_t kBlack = 5;    // At most this is line art
+  const uint8_t kWhite = 250;  // At least this is background already
+
+  const int rows = img.rows;
+  const int cols = img.cols;
+  if (rows == 0 || cols == 0) {
+    return;
+  }
+
+  // One blank column before and two after, so the row filter needs no bounds
+  // checks
+  std::vector<uint8_t> seeds(cols + 3, 0);
+  std::vector<uint8_t> ring(3 * cols);
+  const std::vector<uint8_t> none(cols, 0);
+
+  auto findSeeds = [&](int y) {
+    auto row = img.ptr<uint8_t>(y);
+    auto seed = uint8_t{0};
+    for (int x = 0; x < cols; x++) {
+      seed = (row[x] < kWhite) & ((row[x] > kBlack) | seed);
+      seeds[x + 1] = seed;
+    }
+
+    auto near = &ring[(y % 3) * cols];
+    for (int x = 0; x < cols; x++) {
+      near[x] = seeds[x] | seeds[x + 1] | seeds[x + 2] | seeds[x + 3];
+    }
+  };
+
+  auto whiten = [&](int y) {
+    auto row = img.ptr<uint8_t>(y);
+    auto a = &ring[(y % 3) * cols];
+    auto b = y + 1 < rows ? &ring[((y + 1) % 3) * cols] : none.data();
+    auto c = y + 2 < rows ? &ring[((y + 2) % 3) * cols] : none.data();
+    for (int x = 0; x < cols; x++) {
+      auto val = row[x];
+      auto clear = val > kBlack || (a[x] | b[x] | c[x]);
+      row[x] = val < kWhite && clear ? 255 : val;
+    }
+  };
+
+  // Row y can be whitened once the seeds two rows further down are known
+  for (int y = 0; y < rows; y++) {
+    findSeeds(y);
+    if (y >= 2) {
+      whiten(y - 2);
+    }
+  }
+  for (int y = std::max(0, rows - 2); y < rows; y++) {
+    whiten(y);
+  }
+}
+
+// The original pixel by pixel flood, which BubbleFlood must match exactly
+bool tryFindBubbleSource_Reference_Destructive(cv::Mat img,
+                                               cv::Rect bubbleBounds,
+                                               cv::Rect panelBounds,
+                                               cv::Point& outPt) {
   // This algorithm finds the bottom tip of a speech bubble with a
   // flood-fill-esque technique
   // First, we drop some grey pixels in the middle row of the speech bubble, 2/3
@@ -132,7 +364,145 @@ bool tryFindBubbleSource_Destructive(cv::Mat img, cv::Rect bubbleBounds,
   return lastModifiedCount < kProbablyNotAnArrowedBubble;
 }
 
+namespace {
+
+const uint8_t kBasicallyBlack = 10;
+const uint8_t kFloodGrey = 127;
+const auto kProbablyNotAnArrowedBubble = 5;
+
+}  // namespace
+
+BubbleFlood::BubbleFlood(cv::Mat panelImg)
+    : img{panelImg}, rows(panelImg.rows), labelled(panelImg.rows, false) {}
+
+void BubbleFlood::invalidate(cv::Rect area) {
+  for (auto y = area.y; y < area.y + area.height; y++) {
+    labelled[y] = false;
+  }
+}
+
+std::vector<BubbleFlood::Run>& BubbleFlood::runs(int y) {
+  auto& row = rows[y];
+  if (labelled[y]) {
+    return row;
+  }
+  labelled[y] = true;
+  row.clear();
+
+  // Column 0 never takes part: the reference smear starts at x = 1
+  const auto* pix = img.ptr<uint8_t>(y);
+  for (auto x = 1; x < img.cols;) {
+    if (pix[x] < kBasicallyBlack) {
+      x++;
+      continue;
+    }
+    auto run = Run{x, x, false};
+    for (; x < img.cols && pix[x] >= kBasicallyBlack; x++) {
+      run.grey |= pix[x] == kFloodGrey;
+    }
+    run.end = x;
+    row.push_back(run);
+  }
+  return row;
+}
+
+bool BubbleFlood::tryFindBubbleSource(cv::Rect bubbleBounds,
+                                      cv::Rect panelBounds, cv::Point& outPt) {
+  // The same flood as tryFindBubbleSource_Reference_Destructive, a run at a
+  // time. Grey only ever moves down into pixels under grey and sideways up to
+  // black, so after the seed row the grey in a row is exactly the runs that
+  // either overlap grey runs in the row above or already had grey in them
+  // (left by an earlier bubble, or there in the comic). The bleed count is the
+  // total overlap, and the last x is the end of the rightmost grey run.
+  ASSERT(img.size() == panelBounds.size());
+  const auto minX = bubbleBounds.x + bubbleBounds.width / 6 - panelBounds.x;
+  const auto maxX = minX + 2 * bubbleBounds.width / 3;
+  ASSERT(0 < minX && minX < panelBounds.width);
+  ASSERT(0 < maxX && maxX < panelBounds.width);
+
+  auto lastX = -1;
+  auto y = bubbleBounds.y + bubbleBounds.height / 3 - panelBounds.y;
+  ASSERT(0 < y && y < panelBounds.height);
+
+  // "Seed" grey pixels. Only the seeds themselves bleed into the next row.
+  auto* seedRow = img.ptr<uint8_t>(y);
+  for (auto x = minX; x <= maxX; x++) {
+    if (seedRow[x] >= kBasicallyBlack) {
+      seedRow[x] = kFloodGrey;
+      lastX = x;
+    }
+  }
+  if (lastX == -1) {
+    return false;
+  }
+
+  auto above = std::vector<Run>{};
+  for (auto& run : runs(y)) {
+    if (run.end > minX && run.begin <= maxX) {
+      run.grey = true;
+      above.push_back(
+          Run{std::max(run.begin, minX), std::min(run.end, maxX + 1), true});
+    }
+  }
+
+  y++;
+
+  auto grey = std::vector<Run>{};
+  auto lastModifiedCount = 0;
+  while (true) {
+    if (y == panelBounds.height) {
+      return false;
+    }
+
+    // "Bleed"
+    auto& row = runs(y);
+    auto modifiedCount = 0;
+    size_t first = 0;
+    for (auto& run : row) {
+      while (first < above.size() && above[first].end <= run.begin) {
+        first++;
+      }
+      for (auto i = first; i < above.size() && above[i].begin < run.end;
+           i++) {
+        modifiedCount += std::min(above[i].end, run.end) -
+                         std::max(above[i].begin, run.begin);
+        run.grey = true;
+      }
+    }
+
+    if (modifiedCount == 0) {
+      break;
+    }
+    lastModifiedCount = modifiedCount;
+
+    // "Smear"
+    auto* pix = img.ptr<uint8_t>(y);
+    grey.clear();
+    for (const auto& run : row) {
+      if (run.grey) {
+        std::fill(pix + run.begin, pix + run.end, kFloodGrey);
+        grey.push_back(run);
+      }
+    }
+    lastX = grey.back().end - 1;
+    std::swap(above, grey);
+
+    y++;
+  }
+
+  ASSERT(0 <= lastX && lastX < panelBounds.width);
+  outPt.x = lastX;
+  outPt.y = y;
+  return lastModifiedCount < kProbablyNotAnArrowedBubble;
+}
+
 void attributeDialog(Context& ctx) {
+  auto recognizer = makeActorRecognizer(ctx.actorEngine, ctx.models);
+  if (ctx.actorCache) {
+    recognizer = makeCachedActorRecognizer(
+        std::move(recognizer), ctx.actorEngine, *ctx.actorCache, ctx.stats);
+  }
+
   for (size_t i = 0; i < ctx.panels.size(); i++) {
     const auto& panel = ctx.panels[i];
 
@@ -140,31 +510,43 @@ void attributeDialog(Context& ctx) {
     // space
     auto panelImg = cv::Mat { ctx.img, panel.bounds }
     .clone();
+    auto flood = BubbleFlood{panelImg};
+    auto referenceImg = kCheckInvariants ? panelImg.clone() : cv::Mat{};
 
     for (auto&& bubble : ctx.panels[i].dialog) {
+      ctx.stats.count("bubbles");
       auto pt = cv::Point{};
-      if (tryFindBubbleSource_Destructive(panelImg, bubble.bounds, panel.bounds,
-                                          pt)) {
-        const auto kWindowWidth = 128;
-        const auto kWindowYOffset = 16;
-
-        auto bounds = cv::Rect{std::max(0, pt.x - kWindowWidth / 2),
-                               std::min(panel.bounds.height - 1,
-                                        pt.y + kWindowYOffset),
-                               0, 0};
-        bounds.width = std::min(panel.bounds.width - bounds.x, kWindowWidth);
-        bounds.height = panel.bounds.height - bounds.y;
-        ASSERT(bounds.x < panel.bounds.width);
-        ASSERT(bounds.y < panel.bounds.height);
-        ASSERT(bounds.y + bounds.height <= panel.bounds.height);
-        ASSERT(bounds.x + bounds.width <= panel.bounds.width);
+      const auto found =
+          flood.tryFindBubbleSource(bubble.bounds, panel.bounds, pt);
+      if (kCheckInvariants) {
+        auto referencePt = cv::Point{};
+        const auto referenceFound = tryFindBubbleSource_Reference_Destructive(
+            referenceImg, bubble.bounds, panel.bounds, referencePt);
+        ASSERT(found == referenceFound && (!found || pt == referencePt) &&
+                   cv::norm(referenceImg, panelImg, cv::NORM_INF) == 0,
+               "BubbleFlood differs from the reference");
+      }
+
+      if (found) {
+        const auto bounds = actorWindow(pt, panel.bounds.size());
         auto window = cv::Mat{panelImg, bounds};
 
+        auto reference = kCheckInvariants ? window.clone() : cv::Mat{};
         removeBg_Destructive(window);
+        flood.invalidate(bounds);
+        if (kCheckInvariants) {
+          removeBg_Reference_Destructive(reference);
+          ASSERT(cv::norm(reference, window, cv::NORM_INF) == 0,
+                 "removeBg_Destructive differs from the reference");
+          auto referenceWindow = cv::Mat{referenceImg, bounds};
+          window.copyTo(referenceWindow);
+        }
 
         // All of this is setup to call out to the externally defined image ->
         // name function
-        bubble.actor = findActor(window);
+        ScopedTimer timer{ctx.stats, "attributeDialog/findActor"};
+        bubble.actor = recognizer->findActor(window);
+        ctx.stats.count("bubblesAttributed");
       }
     }
   }
@@ -0,0 +1,110 @@
+#ifndef _ACTORS_H_
+#define _ACTORS_H_
+
+#include "context.h"
+
+// How the descriptor matches against one actor template turn into a score.
+// The best match sets the bar: a match is good if it is within distanceRatio
+// times the best distance (clamped to [minGoodDistance, maxGoodDistance]). The
+// score is the fraction of the template's descriptors that matched well.
+struct ActorScoring {
+  float distanceRatio = 3.0f;
+  float minGoodDistance = 0.5f;
+  float maxGoodDistance = 150.0f;
+  size_t minGoodMatches = 2;
+  double minScore = 0.02;  // anything at or below this isn't the actor
+};
+
+// Scores one template given the distances of the matches that landed on it.
+// Returns a negative score if the template should not be considered at all.
+double scoreActor(const ActorScoring& scoring,
+                  const std::vector<float>& distances,
+                  size_t templateDescriptors);
+
+// Every actor template's descriptors (from one kind of feature) stacked into
+// one matrix with a FLANN index over it, so a window is matched against the
+// whole library with one search. Built once per run.
+struct ActorIndex {
+  cv::Mat descriptors;
+  std::vector<size_t> labels;  // which template each descriptor row came from
+  std::vector<size_t> counts;  // how many descriptors each template has
+  std::shared_ptr<cv::flann::Index> index;  // null if there are no descriptors
+  bool squaredDistances;                    // true for L2 indices
+};
+
+std::shared_ptr<const ActorIndex> buildActorIndex(
+    const std::vector<cv::Mat>& templateDescriptors,
+    const cv::flann::IndexParams& params, cvflann::flann_distance_t distance);
+
+// Looks a window's descriptors up in the index and names the best scoring
+// template. Each template descriptor found as a neighbour is one match, at its
+// closest distance to the window, as when templates were matched one by one.
+std::string voteForActor(const Models& models, const ActorIndex& actors,
+                         const cv::Mat& descriptors,
+                         const ActorScoring& scoring);
+
+// Names the actor in a window cut out under a speech bubble. Anything shared
+// between windows is set up front, after which findActor() may be called from
+// several threads at once.
+class ActorRecognizer {
+ public:
+  virtual ~ActorRecognizer() {}
+
+  // The actor's name, or "unknown"
+  virtual std::string findActor(cv::Mat window) const = 0;
+};
+
+// The stages of attributeDialog before recognition. The tip of a bubble's tail
+// is found by flooding the panel image (in panel coordinates) down from the
+// bubble, the actor is looked for in a window under the tip, and everything
+// but the line art is whited out of that window.
+//
+// The flood only ever stops at black, so BubbleFlood labels each row of the
+// panel into runs of non-black pixels the first time a flood reaches it and
+// floods run by run from then on. The grey is still painted into the image,
+// where later bubbles and the windows cut from it see it as before. Whatever
+// else writes to the image must invalidate() what it wrote.
+class BubbleFlood {
+ public:
+  explicit BubbleFlood(cv::Mat panelImg);
+
+  bool tryFindBubbleSource(cv::Rect bubbleBounds, cv::Rect panelBounds,
+                           cv::Point& outPt);
+  void invalidate(cv::Rect area);
+
+ private:
+  struct Run {
+    int begin;  // [begin, end) of one row
+    int end;
+    bool grey;  // holds at least one grey pixel
+  };
+
+  std::vector<Run>& runs(int y);
+
+  cv::Mat img;
+  std::vector<std::vector<Run>> rows;
+  std::vector<bool> labelled;
+};
+
+// Slow, same result as a BubbleFlood over `img`
+bool tryFindBubbleSource_Reference_Destructive(cv::Mat img,
+                                               cv::Rect bubbleBounds,
+                                               cv::Rect panelBounds,
+                                               cv::Point& outPt);
+cv::Rect actorWindow(cv::Point tip, cv::Size panelSize);
+void removeBg_Destructive(cv::Mat img);
+void removeBg_Reference_Destructive(cv::Mat img);  // slow, same result
+
+// "sift", "orb" or "sift-reference"
+ActorEngine parseActorEngine(const std::string& name);
+std::string actorEngineName(ActorEngine engine);
+
+std::unique_ptr<ActorRecognizer> makeActorRecognizer(ActorEngine engine,
+                                                     const Models& models);
+
+std::unique_ptr<ActorRecognizer> makeSiftActorRecognizer(const Models& models);
+std::unique_ptr<ActorRecognizer> makeOrbActorRecognizer(const Models& models);
+std::unique_ptr<ActorRecognizer> makeReferenceSiftActorRecognizer(
+    const Models& models);
+
+#endif
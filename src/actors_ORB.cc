@@ -0,0 +1,72 @@
+#include "actors.h"
+
+// ORB features matched by Hamming distance through an LSH index. Needs nothing
+// from nonfree, but is no faster than SIFT on windows this small and names
+// fewer actors correctly (see tests/actor_engines.txt), so sift stays the
+// default. Template features are computed from the template images on first
+// use, so bundles don't need to carry them.
+
+namespace {
+
+void findOrbFeatures(cv::Mat img, std::vector<cv::KeyPoint>& outKeypoints,
+                     cv::Mat& outDescriptors) {
+  // Windows are only 128px wide, so use smaller patches than ORB's default 31
+  // to keep features near the edges
+  const int kFeatures = 500;
+  const int kPatchSize = 19;
+
+  auto orb = cv::ORB{kFeatures, 1.2f, 8, kPatchSize, 0, 2,
+                     cv::ORB::HARRIS_SCORE, kPatchSize};
+  // One call, so the image pyramid is built once for both
+  orb(img, cv::noArray(), outKeypoints, outDescriptors);
+}
+
+// Hamming distances between 256 bit descriptors, so the SIFT tuned defaults
+// don't carry over. Calibrated against sift-reference on windows made from the
+// actor templates: a fixed cut did best, the ratio to the best match adding
+// nothing, and random descriptors are ~128 apart.
+ActorScoring orbScoring() {
+  auto scoring = ActorScoring{};
+  scoring.minGoodDistance = 28;
+  scoring.maxGoodDistance = 28;
+  scoring.minGoodMatches = 4;
+  return scoring;
+}
+
+const ActorIndex& orbActorIndex(const Models& models) {
+  return models.orbActorIndex.get([&] {
+    std::vector<cv::Mat> descriptors;
+    for (const auto& actor : models.actors) {
+      auto keypoints = std::vector<cv::KeyPoint>{};
+      auto actorDescriptors = cv::Mat{};
+      findOrbFeatures(actor.img, keypoints, actorDescriptors);
+      descriptors.push_back(actorDescriptors);
+    }
+    return buildActorIndex(descriptors, cv::flann::LshIndexParams{12, 20, 2},
+                           cvflann::FLANN_DIST_HAMMING);
+  });
+}
+
+class OrbActorRecognizer : public ActorRecognizer {
+ public:
+  OrbActorRecognizer(const Models& models_)
+      : models(models_), actors{orbActorIndex(models_)}, scoring{orbScoring()} {}
+
+  std::string findActor(cv::Mat window) const override {
+    auto keypoints = std::vector<cv::KeyPoint>{};
+    auto descriptors = cv::Mat{};
+    findOrbFeatures(window, keypoints, descriptors);
+    return voteForActor(models, actors, descriptors, scoring);
+  }
+
+ private:
+  const Models& models;
+  const ActorIndex& actors;
+  ActorScoring scoring;
+};
+
+}  // namespace
+
+std::unique_ptr<ActorRecognizer> makeOrbActorRecognizer(const Models& models) {
+  return std::unique_ptr<ActorRecognizer>{new OrbActorRecognizer{models}};
+}
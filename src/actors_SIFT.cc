@@ -1,4 +1,4 @@
-#include "context.h"
+#include "actors.h"
 
 #include <opencv2/nonfree/nonfree.hpp>
 
@@ -11,80 +11,105 @@ void findFeatures(cv::Mat img, std::vector<cv::KeyPoint>& outKeypoints,
   extractor.compute(img, outKeypoints, outDescriptors);
 }
 
-struct ActorTemplate {
-  ActorTemplate(const Template& genericTemplate) {
-    findFeatures(genericTemplate.img, keypoints, descriptors);
-    ASSERT(!descriptors.empty(),
-           "no features detected in this actor template!");
-    name = genericTemplate.name;
-    img = genericTemplate.img;
+ActorTemplate::ActorTemplate(const Template& genericTemplate) {
+  findFeatures(genericTemplate.img, keypoints, descriptors);
+  ASSERT(!descriptors.empty(), "no features detected in this actor template!");
+  name = genericTemplate.name;
+  img = genericTemplate.img;
+}
+
+std::vector<ActorTemplate> loadActors(const std::string& pathStr) {
+  auto genericTmpls = loadTemplates(pathStr);
+  auto actorTmpls = std::vector<ActorTemplate>{};
+  actorTmpls.reserve(2 * genericTmpls.size() + 1);
+  for (auto&& tmpl : genericTmpls) {
+    actorTmpls.emplace_back(tmpl);
+    auto tmplFlipped = tmpl;
+    tmplFlipped.img = cv::Mat{};
+    cv::flip(tmpl.img, tmplFlipped.img, 1);
+    actorTmpls.emplace_back(tmplFlipped);
   }
+  return actorTmpls;
+}
 
-  cv::Mat img;
-  std::vector<cv::KeyPoint> keypoints;
-  cv::Mat descriptors;
-  std::string name;
-};
+namespace {
 
-std::string findActor(cv::Mat img) {
-  auto keypoints = std::vector<cv::KeyPoint>{};
-  auto descriptors = cv::Mat{};
-
-  static auto actorTmpls = std::vector<ActorTemplate>{};
-  if (actorTmpls.empty()) {
-    auto genericTmpls = loadTemplates("actors");
-    actorTmpls.reserve(2 * genericTmpls.size() + 1);
-    for (auto&& tmpl : genericTmpls) {
-      actorTmpls.emplace_back(tmpl);
-      auto tmplFlipped = tmpl;
-      tmplFlipped.img = cv::Mat{};
-      cv::flip(tmpl.img, tmplFlipped.img, 1);
-      actorTmpls.emplace_back(tmplFlipped);
+const ActorIndex& siftActorIndex(const Models& models) {
+  return models.siftActorIndex.get([&] {
+    std::vector<cv::Mat> descriptors;
+    for (const auto& actor : models.actors) {
+      descriptors.push_back(actor.descriptors);
     }
-  }
+    return buildActorIndex(descriptors, cv::flann::KDTreeIndexParams{4},
+                           cvflann::FLANN_DIST_L2);
+  });
+}
 
-  findFeatures(img, keypoints, descriptors);
+class SiftActorRecognizer : public ActorRecognizer {
+ public:
+  SiftActorRecognizer(const Models& models_)
+      : models(models_), actors{siftActorIndex(models_)} {}
 
-  if (descriptors.empty()) {
-    return "unknown";
+  std::string findActor(cv::Mat window) const override {
+    auto keypoints = std::vector<cv::KeyPoint>{};
+    auto descriptors = cv::Mat{};
+    findFeatures(window, keypoints, descriptors);
+    return voteForActor(models, actors, descriptors, ActorScoring{});
   }
 
-  std::vector<std::pair<double, const ActorTemplate&>> actorMatches;
-
-  for (const auto& actor : actorTmpls) {
-    auto matcher = cv::FlannBasedMatcher{};
-    auto matches = std::vector<cv::DMatch>{};
-    matcher.match(actor.descriptors, descriptors, matches);
-
-    auto bounds = std::minmax_element(
-        matches.begin(), matches.end(),
-        [](const auto& a, const auto& b) { return a.distance < b.distance; });
-    float minDist =
-        std::min(150.0f, std::max(3.0f * bounds.first->distance, 0.5f));
-
-    auto goodMatches = std::vector<cv::DMatch>{};
-    std::copy_if(matches.begin(), matches.end(),
-                 std::back_inserter(goodMatches),
-                 [minDist](const auto& m) { return m.distance <= minDist; });
+ private:
+  const Models& models;
+  const ActorIndex& actors;
+};
 
-    if (goodMatches.size() < 2) {
-      continue;
+// The matcher Sift replaced: each template's descriptors are matched against
+// the window's with a fresh FlannBasedMatcher, one match per template
+// descriptor, and scored with the same policy
+class ReferenceSiftActorRecognizer : public ActorRecognizer {
+ public:
+  ReferenceSiftActorRecognizer(const Models& models_) : models(models_) {}
+
+  std::string findActor(cv::Mat window) const override {
+    auto keypoints = std::vector<cv::KeyPoint>{};
+    auto descriptors = cv::Mat{};
+    findFeatures(window, keypoints, descriptors);
+    if (descriptors.empty()) {
+      return "unknown";
     }
 
-    double score = (double)goodMatches.size() / (double)matches.size();
-    if (score > 0.02f) {
-      actorMatches.emplace_back(score, actor);
-      // std::cerr << actor.name << ": " << goodMatches.size() << " out of " <<
-      // matches.size() << ": " << score << "\n";
+    const auto scoring = ActorScoring{};
+    auto bestScore = -1.0;
+    const ActorTemplate* best = nullptr;
+    for (const auto& actor : models.actors) {
+      auto matcher = cv::FlannBasedMatcher{};
+      auto matches = std::vector<cv::DMatch>{};
+      matcher.match(actor.descriptors, descriptors, matches);
+
+      auto distances = std::vector<float>{};
+      for (const auto& match : matches) {
+        distances.push_back(match.distance);
+      }
+      auto score = scoreActor(scoring, distances, matches.size());
+      if (score > bestScore) {
+        bestScore = score;
+        best = &actor;
+      }
     }
+    return best != nullptr ? best->name : "unknown";
   }
 
-  if (actorMatches.empty()) {
-    return "unknown";
-  }
+ private:
+  const Models& models;
+};
+
+}  // namespace
+
+std::unique_ptr<ActorRecognizer> makeSiftActorRecognizer(const Models& models) {
+  return std::unique_ptr<ActorRecognizer>{new SiftActorRecognizer{models}};
+}
 
-  return std::max_element(actorMatches.begin(), actorMatches.end(),
-                          [](const auto& a, const auto& b) {
-                            return a.first < b.first;
-                          })->second.name;
+std::unique_ptr<ActorRecognizer> makeReferenceSiftActorRecognizer(
+    const Models& models) {
+  return std::unique_ptr<ActorRecognizer>{
+      new ReferenceSiftActorRecognizer{models}};
 }
@@ -0,0 +1,547 @@
+#include "actors.h"
+#include "context.h"
+#include "glyphmatch.h"
+#include "perf.h"
+#include "untypeset.h"
+
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace fs = boost::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+void findPanels(Context& ctx);
+void findTextRegions(Context& ctx);
+void untypeset(Context& ctx);
+void attributeDialog(Context& ctx);
+
+// Every operator new in the process, so that benchmarks can report how many
+// allocations a call makes. OpenCV allocates image data with its own malloc
+// wrapper, so Mat buffers aren't included.
+std::atomic<size_t> allocations{0};
+
+void* operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// One benchmark's results, all per call
+struct Measurement {
+  std::string name;     // what was called
+  std::string variant;  // engine, template size, ... (may be empty)
+  std::string input;    // fixture, and how many times it was tiled
+  size_t calls = 0;
+  double meanMs = 0;
+  double minMs = 0;
+  double items = 0;  // work done, in units
+  std::string unit;
+  double allocations = 0;
+  double cycles = 0;
+  double instructions = 0;
+  double cacheMisses = 0;
+
+  std::string id() const {
+    return name + (variant.empty() ? "" : "/" + variant) + "@" + input;
+  }
+};
+
+class Bench {
+ public:
+  explicit Bench(size_t iterations_) : iterations{iterations_} {}
+
+  void setInput(const std::string& input_) { input = input_; }
+
+  // Times run(setup()) `iterations` times after one untimed warm up (which
+  // also builds any lazily cached model data). Only run() is measured, so
+  // destructive functions can be handed fresh input by setup() every call.
+  template <class Setup, class Run>
+  void measure(const std::string& name, const std::string& variant,
+               const std::string& unit, double items, Setup setup, Run run) {
+    {
+      auto state = setup();
+      run(state);
+    }
+
+    auto result = Measurement{};
+    result.name = name;
+    result.variant = variant;
+    result.input = input;
+    result.calls = iterations;
+    result.items = items;
+    result.unit = unit;
+    result.minMs = DBL_MAX;
+    size_t allocs = 0;
+    auto counters = PerfCounters::Reading{};
+    for (size_t i = 0; i < iterations; i++) {
+      auto state = setup();
+
+      auto allocsBefore = allocations.load();
+      perf.start();
+      auto start = Clock::now();
+      run(state);
+      auto ms = msSince(start);
+      auto reading = perf.stop();
+      allocs += allocations.load() - allocsBefore;
+
+      result.meanMs += ms / iterations;
+      result.minMs = std::min(result.minMs, ms);
+      counters.cycles += reading.cycles;
+      counters.instructions += reading.instructions;
+      counters.cacheMisses += reading.cacheMisses;
+    }
+    result.allocations = double(allocs) / iterations;
+    result.cycles = double(counters.cycles) / iterations;
+    result.instructions = double(counters.instructions) / iterations;
+    result.cacheMisses = double(counters.cacheMisses) / iterations;
+
+    std::cout << result.id() << ": " << result.meanMs << " ms (min "
+              << result.minMs << "), " << throughput(result) << " " << unit
+              << "/s, " << result.allocations << " allocs";
+    if (perf.available()) {
+      std::cout << ", " << result.cycles << " cycles, " << result.instructions
+                << " instructions, " << result.cacheMisses
+                << " cache misses";
+    }
+    std::cout << "\n";
+    results.push_back(std::move(result));
+  }
+
+  // One benchmark per line, in a fixed order, so two runs diff cleanly
+  void printJson(std::ostream& out) const {
+    out << "{\n  \"perfCounters\": " << (perf.available() ? "true" : "false")
+        << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+      const auto& r = results[i];
+      out << (i == 0 ? "\n" : ",\n") << "    {\"id\": \"" << r.id()
+          << "\", \"calls\": " << r.calls << ", \"meanMs\": " << r.meanMs
+          << ", \"minMs\": " << r.minMs << ", \"items\": " << r.items
+          << ", \"unit\": \"" << r.unit
+          << "\", \"throughput\": " << throughput(r)
+          << ", \"allocations\": " << r.allocations;
+      if (perf.available()) {
+        out << ", \"cycles\": " << r.cycles
+            << ", \"instructions\": " << r.instructions
+            << ", \"cacheMisses\": " << r.cacheMisses;
+      }
+      out << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+ private:
+  static double throughput(const Measurement& result) {
+    return result.meanMs > 0 ? result.items / (result.meanMs / 1000) : 0;
+  }
+
+  size_t iterations;
+  std::string input;
+  PerfCounters perf;
+  std::vector<Measurement> results;
+};
+
+const auto nothing = [] { return 0; };
+
+const auto kMatchEngines = std::vector<std::pair<std::string, MatchEngine>>{
+    {"direct", MatchEngine::Direct},
+    {"fft", MatchEngine::Fft},
+    {"binary", MatchEngine::Binary}};
+// The first is what the others' attributions are checked against
+const auto kActorEngines = std::vector<std::pair<std::string, ActorEngine>>{
+    {"sift-reference", ActorEngine::SiftReference},
+    {"sift", ActorEngine::Sift},
+    {"orb", ActorEngine::Orb}};
+
+double area(const std::vector<cv::Rect>& rects) {
+  auto result = 0.0;
+  for (const auto& rect : rects) {
+    result += rect.area();
+  }
+  return result;
+}
+
+// Glyph matching with every engine, for each size of template on its own and
+// for all of them together. Checks that the engines find the same glyphs.
+void benchGlyphMatching(Bench& bench, Context& ctx) {
+  const size_t kMaxChars = 5000;
+  const auto& templates = ctx.models.glyphs;
+
+  std::map<std::pair<int, int>, std::vector<size_t>> bySize;
+  for (size_t i = 0; i < templates.size(); i++) {
+    const auto size = templates[i].img.size();
+    bySize[{size.width, size.height}].push_back(i);
+  }
+
+  std::vector<std::vector<CharBox>> found;
+  for (const auto& engine : kMatchEngines) {
+    bench.measure("makeGlyphMatcher", engine.first, "px", area(ctx.textRegions),
+                  nothing, [&](int) {
+                    makeGlyphMatcher(engine.second, ctx.img, ctx.textRegions,
+                                     ctx.models);
+                  });
+
+    auto matcher = makeGlyphMatcher(engine.second, ctx.img, ctx.textRegions,
+                                    ctx.models);
+    for (const auto& size : bySize) {
+      const auto variant = engine.first + "/" +
+                           std::to_string(size.first.first) + "x" +
+                           std::to_string(size.first.second);
+      bench.measure("matchGlyph", variant, "templates", size.second.size(),
+                    nothing, [&](int) {
+                      for (auto t : size.second) {
+                        matchGlyph(*matcher, templates, t, ctx.textRegions,
+                                   kMaxChars);
+                      }
+                    });
+    }
+
+    ctx.matchEngine = engine.second;
+    bench.measure("findGlyphs", engine.first, "templates", templates.size(),
+                  nothing, [&](int) { findGlyphs(ctx, templates); });
+    found.push_back(findGlyphs(ctx, templates));
+  }
+  ctx.matchEngine = MatchEngine::Direct;
+
+  // The binary engine's scan as built for baseline x86-64, and as built for
+  // POPCNT and AVX2, which the binary engine uses where the CPU has them
+  std::cout << "binary engine POPCNT/AVX2 scan: "
+            << (binaryGlyphMatcherHasSimd() ? "used" : "not supported here")
+            << "\n";
+  for (auto simd : {false, true}) {
+    if (simd && !binaryGlyphMatcherHasSimd()) {
+      continue;
+    }
+    auto matcher = makeBinaryGlyphMatcher(ctx.img, ctx.textRegions,
+                                          ctx.models, simd);
+    bench.measure("matchGlyph", simd ? "binary/popcnt-avx2" : "binary/portable",
+                  "templates", templates.size(), nothing, [&](int) {
+                    for (size_t t = 0; t < templates.size(); t++) {
+                      matchGlyph(*matcher, templates, t, ctx.textRegions,
+                                 kMaxChars);
+                    }
+                  });
+  }
+
+  for (size_t e = 1; e < found.size(); e++) {
+    auto same = found[e].size() == found[0].size();
+    for (size_t i = 0; same && i < found[0].size(); i++) {
+      same = found[e][i].bounds == found[0][i].bounds &&
+             found[e][i].ch == found[0][i].ch;
+    }
+    std::cout << kMatchEngines[e].first << " vs " << kMatchEngines[0].first
+              << ": " << (same ? "same" : "DIFFERENT") << " glyphs ("
+              << found[e].size() << " vs " << found[0].size() << ")\n";
+  }
+
+  // The scan for matches on its own, over one atlas per template size
+  auto matcher =
+      makeGlyphMatcher(MatchEngine::Direct, ctx.img, ctx.textRegions, ctx.models);
+  std::vector<std::pair<cv::Mat, cv::Size>> atlases;
+  auto atlasArea = 0.0;
+  for (const auto& size : bySize) {
+    for (size_t r = 0; r < ctx.textRegions.size(); r++) {
+      const auto tmpl = size.second.front();
+      if (ctx.textRegions[r].width < templates[tmpl].img.cols ||
+          ctx.textRegions[r].height < templates[tmpl].img.rows) {
+        continue;
+      }
+      atlases.emplace_back(matcher->match(tmpl, r), templates[tmpl].img.size());
+      atlasArea += atlases.back().first.total();
+    }
+  }
+  bench.measure("forEachCredibleMatch", "", "px", atlasArea, nothing, [&](int) {
+    size_t hits = 0;
+    for (const auto& atlas : atlases) {
+      forEachCredibleMatch(atlas.first, atlas.second, [&](int, int, float) {
+        hits++;
+        return true;
+      });
+    }
+    return hits;
+  });
+}
+
+// Conflict resolution over a strip's worth of synthetic candidates, packed far
+// more densely than real glyphs so that most of them overlap something
+std::vector<CharBox> syntheticCandidates() {
+  const size_t kCandidates = 5000;
+  const auto glyph = cv::Size{12, 15};
+
+  auto rng = std::mt19937{1};
+  auto jitter = std::uniform_int_distribution<int>{0, 7};
+  auto score = std::uniform_real_distribution<float>{0, 100000};
+  std::vector<CharBox> candidates;
+  for (size_t i = 0; i < kCandidates; i++) {
+    auto ch = CharBox{};
+    ch.ch = 'A' + i % 26;
+    ch.score = score(rng);
+    ch.bounds = cv::Rect{{int(i % 100) * 8 + jitter(rng),
+                          int(i / 100) * 10 + jitter(rng)},
+                         glyph};
+    ch.id = i;
+    candidates.push_back(ch);
+  }
+  return candidates;
+}
+
+// Conflict resolution and each assembly stage, fed what the stage before it
+// produced for this comic
+void benchAssembly(Bench& bench, Context& ctx) {
+  const auto synthetic = syntheticCandidates();
+  bench.measure("filterConflictingGlyphs", "synthetic", "candidates",
+                synthetic.size(), [&] { return synthetic; },
+                [&](std::vector<CharBox>& candidates) {
+                  filterConflictingGlyphs(ctx, candidates);
+                });
+
+  auto chars = findGlyphs(ctx, ctx.models.glyphs);
+  bench.measure("filterConflictingGlyphs", "", "candidates", chars.size(),
+                [&] { return chars; }, [&](std::vector<CharBox>& candidates) {
+                  filterConflictingGlyphs(ctx, candidates);
+                });
+  filterConflictingGlyphs(ctx, chars);
+
+  auto glyphs = GlyphArena{chars};
+  auto chunks = initStrBoxes(glyphs);
+  auto stage = [&](const std::string& name, auto collector) {
+    using State = std::pair<GlyphArena, std::vector<StrBox>>;
+    bench.measure(name, "", "chunks", chunks.size(),
+                  [&] { return State{glyphs, chunks}; },
+                  [&](State& state) {
+                    collector(ctx, state.first, state.second);
+                  });
+    collector(ctx, glyphs, chunks);
+  };
+  stage("collectWords", collectWords);
+  stage("collectLines", collectLines);
+  stage("filterGarbageLines", filterGarbageLines);
+  stage("collectBubbles", collectBubbles);
+
+  auto clearDialog = [&] {
+    for (auto& panel : ctx.panels) {
+      panel.dialog.clear();
+    }
+    return 0;
+  };
+  bench.measure("untypeset", "", "templates", ctx.models.glyphs.size(),
+                clearDialog, [&](int) { untypeset(ctx); });
+}
+
+// The stages of speaker attribution, on the bubbles untypeset found
+void benchAttribution(Bench& bench, Context& ctx) {
+  auto panelImages = [&] {
+    std::vector<cv::Mat> result;
+    for (const auto& panel : ctx.panels) {
+      result.push_back(cv::Mat{ctx.img, panel.bounds}.clone());
+    }
+    return result;
+  };
+
+  size_t bubbles = 0;
+  for (const auto& panel : ctx.panels) {
+    bubbles += panel.dialog.size();
+  }
+
+  // Tip finding scribbles over the panel and later bubbles see that, just as
+  // in attributeDialog
+  auto findTips = [&](std::vector<cv::Mat>& images,
+                      std::vector<cv::Mat>* outWindows) {
+    for (size_t i = 0; i < ctx.panels.size(); i++) {
+      const auto& panel = ctx.panels[i];
+      auto flood = BubbleFlood{images[i]};
+      for (const auto& bubble : panel.dialog) {
+        auto pt = cv::Point{};
+        if (flood.tryFindBubbleSource(bubble.bounds, panel.bounds, pt) &&
+            outWindows) {
+          outWindows->push_back(
+              cv::Mat{images[i], actorWindow(pt, panel.bounds.size())}
+                  .clone());
+        }
+      }
+    }
+  };
+  bench.measure("BubbleFlood", "", "bubbles", bubbles, panelImages,
+                [&](std::vector<cv::Mat>& images) { findTips(images, nullptr); });
+  bench.measure("tryFindBubbleSource_Reference_Destructive", "", "bubbles",
+                bubbles, panelImages, [&](std::vector<cv::Mat>& images) {
+                  for (size_t i = 0; i < ctx.panels.size(); i++) {
+                    const auto& panel = ctx.panels[i];
+                    for (const auto& bubble : panel.dialog) {
+                      auto pt = cv::Point{};
+                      tryFindBubbleSource_Reference_Destructive(
+                          images[i], bubble.bounds, panel.bounds, pt);
+                    }
+                  }
+                });
+
+  std::vector<cv::Mat> windows;
+  auto images = panelImages();
+  findTips(images, &windows);
+
+  auto windowArea = 0.0;
+  for (const auto& window : windows) {
+    windowArea += window.total();
+  }
+  bench.measure("removeBg_Destructive", "", "px", windowArea,
+                [&] {
+                  std::vector<cv::Mat> result;
+                  for (const auto& window : windows) {
+                    result.push_back(window.clone());
+                  }
+                  return result;
+                },
+                [&](std::vector<cv::Mat>& windows) {
+                  for (auto& window : windows) {
+                    removeBg_Destructive(window);
+                  }
+                });
+  bench.measure("removeBg_Reference_Destructive", "", "px", windowArea,
+                [&] {
+                  std::vector<cv::Mat> result;
+                  for (const auto& window : windows) {
+                    result.push_back(window.clone());
+                  }
+                  return result;
+                },
+                [&](std::vector<cv::Mat>& windows) {
+                  for (auto& window : windows) {
+                    removeBg_Reference_Destructive(window);
+                  }
+                });
+
+  size_t differences = 0;
+  for (auto& window : windows) {
+    auto reference = window.clone();
+    removeBg_Reference_Destructive(reference);
+    removeBg_Destructive(window);
+    differences += cv::norm(reference, window, cv::NORM_INF) != 0;
+  }
+  std::cout << "removeBg_Destructive vs reference: " << differences << " of "
+            << windows.size() << " windows differ\n";
+
+  std::vector<std::vector<std::string>> found;
+  for (const auto& engine : kActorEngines) {
+    auto recognizer = makeActorRecognizer(engine.second, ctx.models);
+    bench.measure("findActor", engine.first, "windows", windows.size(),
+                  nothing, [&](int) {
+                    for (const auto& window : windows) {
+                      recognizer->findActor(window);
+                    }
+                  });
+    found.emplace_back();
+    for (const auto& window : windows) {
+      found.back().push_back(recognizer->findActor(window));
+    }
+  }
+
+  for (size_t e = 1; e < found.size(); e++) {
+    size_t disagreements = 0;
+    for (size_t w = 0; w < windows.size(); w++) {
+      disagreements += found[e][w] != found[0][w];
+    }
+    std::cout << kActorEngines[e].first << " vs " << kActorEngines[0].first
+              << ": " << disagreements << " of " << windows.size()
+              << " windows attributed differently\n";
+  }
+
+  bench.measure("attributeDialog", "", "bubbles", bubbles, nothing,
+                [&](int) { attributeDialog(ctx); });
+}
+
+// Every stage, in pipeline order, each fed what the stages before it produced
+void benchStages(Bench& bench, Context& ctx) {
+  const auto pixels = double(ctx.img.total());
+  // findPanels fills in the starring panel, so every call gets the comic back
+  // as it was loaded
+  const auto original = ctx.img.clone();
+  bench.measure("findPanels", "", "px", pixels, [&] {
+    original.copyTo(ctx.img);
+    ctx.panels.clear();
+    return 0;
+  }, [&](int) { findPanels(ctx); });
+  bench.measure("findTextRegions", "", "px", pixels, nothing,
+                [&](int) { findTextRegions(ctx); });
+
+  benchGlyphMatching(bench, ctx);
+  benchAssembly(bench, ctx);
+  benchAttribution(bench, ctx);
+}
+
+std::vector<int> parseScales(const std::string& spec) {
+  std::vector<int> scales;
+  auto in = std::istringstream{spec};
+  std::string scale;
+  while (std::getline(in, scale, ',')) {
+    scales.push_back(std::stoi(scale));
+    if (scales.back() < 1) {
+      throw std::runtime_error{"Bad scale: " + scale};
+    }
+  }
+  return scales;
+}
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = po::options_description{"Allowed options"};
+  desc.add_options()("help", "this message")(
+      "input-file", po::value<std::vector<std::string>>(),
+      "fixture comic to benchmark with (may be repeated)")(
+      "models", po::value<std::string>(),
+      "model bundle built by jerkcity-pack")(
+      "iterations", po::value<size_t>()->default_value(5),
+      "timed runs per benchmark")(
+      "scales", po::value<std::string>()->default_value("1,4"),
+      "also run on each fixture tiled this many times side by side")(
+      "json", po::value<std::string>(),
+      "file to write the results to as JSON, for comparing builds");
+
+  auto vm = po::variables_map{};
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("input-file")) {
+    std::cout << desc << "\n";
+    return -1;
+  }
+
+  const auto models =
+      loadModels(vm.count("models") ? vm["models"].as<std::string>() : "");
+  const auto scales = parseScales(vm["scales"].as<std::string>());
+
+  Bench bench{std::max<size_t>(1, vm["iterations"].as<size_t>())};
+  for (const auto& file : vm["input-file"].as<std::vector<std::string>>()) {
+    for (auto scale : scales) {
+      auto ctx = Context{file, models, false};
+      ctx.proposeTextRegions = true;
+      ctx.img = cv::repeat(ctx.img, 1, scale);
+      bench.setInput(fs::path{file}.filename().string() + "*" +
+                     std::to_string(scale));
+      benchStages(bench, ctx);
+    }
+  }
+
+  if (vm.count("json")) {
+    std::ofstream fout{vm["json"].as<std::string>()};
+    bench.printJson(fout);
+  }
+}
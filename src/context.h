@@ -2,11 +2,19 @@
 #define _CONTEXT_H_
 
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include <opencv2/opencv.hpp>
 
+#include "dictionary.h"
+#include "overlay.h"
+#include "stats.h"
+
 inline void threshold(cv::Mat img) {
   cv::adaptiveThreshold(img, img, 255, CV_ADAPTIVE_THRESH_GAUSSIAN_C,
                         CV_THRESH_BINARY, 5, 5);
@@ -27,29 +35,131 @@ struct Panel {
   std::vector<Bubble> dialog;
 };
 
-struct Context {
-  Context(const std::string& file, bool debug);
+struct Template {
+  Template(std::string name_, cv::Mat img_) : name{name_}, img{img_} {}
 
-  bool debug;
-  bool debugJson;
+  std::string name;
   cv::Mat img;
-  cv::Mat debugImg;
-  std::vector<Panel> panels;
 };
 
-struct Template {
-  Template(std::string name_, cv::Mat img_) : name{name_}, img{img_} {}
+struct ActorTemplate {
+  ActorTemplate(const Template& genericTemplate);
+  ActorTemplate(std::string name_, cv::Mat img_,
+                std::vector<cv::KeyPoint> keypoints_, cv::Mat descriptors_)
+      : img{img_},
+        keypoints{std::move(keypoints_)},
+        descriptors{descriptors_},
+        name{name_} {}
 
+  cv::Mat img;
+  std::vector<cv::KeyPoint> keypoints;
+  cv::Mat descriptors;
   std::string name;
+};
+
+// A value built the first time something asks for it. Copies share the value,
+// and concurrent first calls build it only once.
+template <class T>
+class Lazy {
+ public:
+  template <class F>
+  const T& get(F make) const {
+    std::call_once(state->once, [&] { state->value = make(); });
+    return *state->value;
+  }
+
+ private:
+  struct State {
+    std::once_flag once;
+    std::shared_ptr<const T> value;
+  };
+  std::shared_ptr<State> state = std::make_shared<State>();
+};
+
+struct GlyphSpectra;  // The FFT matching engine's view of the glyphs
+struct GlyphBitmaps;  // The binary matching engine's view of the glyphs
+struct ActorIndex;    // Every actor descriptor of one kind, indexed
+
+// Everything loaded from disk up front. A single instance is shared (read-only)
+// by every comic processed in a run.
+struct Models {
+  std::vector<Template> glyphs;
+  Dictionary words;
+  std::vector<ActorTemplate> actors;
+  std::shared_ptr<const void> storage;  // backs the Mats above when they were
+                                        // mapped from a bundle
+  Lazy<GlyphSpectra> glyphSpectra;
+  Lazy<GlyphBitmaps> glyphBitmaps;
+  Lazy<ActorIndex> siftActorIndex;
+  Lazy<ActorIndex> orbActorIndex;
+};
+
+class WorkStealingPool;
+class ActorCache;
+
+enum class MatchEngine {
+  Direct,  // cv::matchTemplate per template
+  Fft,     // one transform of the comic shared by every template
+  Binary,  // bit-packed prefilter, exact SQDIFF only where it might match
+};
+
+enum class ActorEngine {
+  Sift,  // SIFT features, KD-tree over L2 distances
+  Orb,   // ORB features, LSH over Hamming distances
+  // The original SIFT matcher: every template matched against the window on
+  // its own. Slow, kept to check Sift's attributions against.
+  SiftReference,
+};
+
+struct Context {
+  Context(const std::string& file, const Models& models, bool debug);
+  // A comic already in memory, in any format cv::imdecode reads
+  Context(const std::vector<uchar>& encoded, const Models& models, bool debug);
+
+  const Models& models;
+  bool debug;  // whether to record the overlay
+  bool debugJson = false;
+  std::ostringstream debugOut;  // JSON debug data, flushed once per comic so
+                                // concurrent comics don't interleave
   cv::Mat img;
+  DebugOverlay overlay;
+  std::vector<Panel> panels;
+  bool proposeTextRegions = false;  // if false, glyphs are searched for
+                                    // everywhere
+  std::vector<cv::Rect> textRegions;  // where findGlyphs looks, disjoint
+  MatchEngine matchEngine = MatchEngine::Direct;
+  ActorEngine actorEngine = ActorEngine::Sift;
+  WorkStealingPool* pool = nullptr;  // if set, stages may fan out onto this
+  ActorCache* actorCache = nullptr;  // if set, shared with other comics
+  StatsRecorder stats;  // off unless enabled
 };
 
-inline void printRectJson(const cv::Rect& bounds) {
-  std::cerr << "\"x\": " << bounds.x << ", \"y\": " << bounds.y
+inline void printRectJson(std::ostream& out, const cv::Rect& bounds) {
+  out << "\"x\": " << bounds.x << ", \"y\": " << bounds.y
             << ", \"w\": " << bounds.width << ", \"h\": " << bounds.height;
 }
 
 std::vector<Template> loadTemplates(const std::string& pathStr);
+// Where the word list comes from unless a bundle says otherwise
+const char* const kWordsPath = "/usr/share/dict/words";
+
+std::set<std::string> loadWords(const std::string& pathStr);
+std::vector<ActorTemplate> loadActors(const std::string& pathStr);
+
+// Loads from the given bundle, or if none is given from the bundle next to the
+// executable, falling back to the template directories in the working dir.
+Models loadModels(const std::string& bundlePath);
+void writeBundle(const std::string& path, const std::vector<Template>& glyphs,
+                 const std::vector<ActorTemplate>& actors,
+                 const Dictionary& words);
+
+// Whether to run internal consistency checks that are too slow to leave on
+// (`make check` builds with them)
+#ifdef CHECK_INVARIANTS
+const bool kCheckInvariants = true;
+#else
+const bool kCheckInvariants = false;
+#endif
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
@@ -0,0 +1,49 @@
+#include "corpus.h"
+
+#include <condition_variable>
+#include <mutex>
+
+#include "context.h"
+#include "pool.h"
+
+void transcribeCorpus(
+    WorkStealingPool& pool, const std::vector<std::string>& inputs,
+    std::function<ComicResult(const std::string&)> transcribe,
+    std::function<void(const std::string&, const ComicResult&)> emit) {
+  // Reorder buffer: workers drop results into their slot, the calling thread
+  // drains slots from the front as they fill up.
+  std::mutex mutex;
+  std::condition_variable slotFilled;
+  std::vector<ComicResult> slots(inputs.size());
+  std::vector<bool> ready(inputs.size(), false);
+
+  for (size_t i = 0; i < inputs.size(); i++) {
+    pool.submit([&, i] {
+      auto result = ComicResult{};
+      try {
+        result = transcribe(inputs[i]);
+      }
+      catch (const std::exception& e) {
+        result.ok = false;
+        result.log += inputs[i] + ": " + e.what() + "\n";
+      }
+
+      // Notify under the lock so the caller can't see the last slot filled
+      // (and tear down these locals) before we are done notifying
+      std::lock_guard<std::mutex> lock{mutex};
+      slots[i] = std::move(result);
+      ready[i] = true;
+      slotFilled.notify_one();
+    });
+  }
+
+  for (size_t next = 0; next < inputs.size(); next++) {
+    auto result = ComicResult{};
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      slotFilled.wait(lock, [&] { return ready[next]; });
+      result = std::move(slots[next]);
+    }
+    emit(inputs[next], result);
+  }
+}
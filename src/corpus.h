@@ -0,0 +1,20 @@
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "pipeline.h"
+
+class WorkStealingPool;
+
+// Runs transcribe() over every input on the pool. Results are handed to emit()
+// on the calling thread strictly in input order, each as soon as it and all of
+// its predecessors are done.
+void transcribeCorpus(
+    WorkStealingPool& pool, const std::vector<std::string>& inputs,
+    std::function<ComicResult(const std::string&)> transcribe,
+    std::function<void(const std::string&, const ComicResult&)> emit);
+
+#endif
@@ -0,0 +1,509 @@
+#include "actorcache.h"
+#include "actors.h"
+#include "context.h"
+#include "glyphmatch.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "stream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Transcribes comics on a fixed set of worker threads, oldest request first.
+// At most `queueLimit` requests wait for a worker, counting those admitted
+// whose images are still being read; past that they are turned away at once
+// rather than left to miss their deadlines. Remembers the latency and stage
+// stats of recent requests for printStats().
+class Server {
+ public:
+  Server(const Models& models_, const RunSettings& settings_, size_t workers,
+         size_t queueLimit_)
+      : models(models_), settings(settings_), queueLimit{queueLimit_} {
+    for (size_t i = 0; i < workers; i++) {
+      threads.emplace_back([this] { workerLoop(); });
+    }
+  }
+
+  ~Server() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  Server(const Server&) = delete;
+  Server& operator=(const Server&) = delete;
+
+  // Takes a place in the queue for a request whose image is yet to be read,
+  // or if the queue is full fills in `outRejection` and returns false. An
+  // admitted request must go on to transcribe() or cancel().
+  bool admit(size_t id, Clock::time_point arrived, ComicResult& outRejection);
+  void cancel();
+
+  // Blocks until the comic is done or the deadline passes, whichever is first.
+  // A comic still waiting at its deadline is never started.
+  ComicResult transcribe(std::vector<uchar> encoded, size_t id,
+                         Clock::time_point arrived, Clock::time_point deadline);
+
+  // One line of JSON: the queue, request counts, latency percentiles over the
+  // last kWindow requests (all of them, and just those served) and a
+  // per-stage summary of the last kWindow served
+  void printStats(std::ostream& out);
+
+ private:
+  static const size_t kWindow = 1000;
+
+  enum class Outcome { Served, Expired, Rejected };
+
+  struct Job {
+    std::vector<uchar> encoded;
+    std::string name;
+    Clock::time_point deadline;
+    bool finished = false;  // guarded by Server::mutex
+    ComicResult result;
+  };
+
+  void workerLoop();
+  // Takes the lock itself
+  void remember(Outcome outcome, double latencyMs, const StageStats* stats);
+
+  const Models& models;
+  const RunSettings settings;
+  const size_t queueLimit;
+  std::vector<std::thread> threads;
+
+  std::mutex mutex;
+  std::condition_variable wake;      // a job was queued, or stopping
+  std::condition_variable finished;  // a job finished
+  std::deque<std::shared_ptr<Job>> queue;
+  size_t admitted = 0;  // holding a place in the queue, not yet in it
+  size_t running = 0;
+  bool stopping = false;
+  size_t served = 0;
+  size_t rejected = 0;
+  size_t expired = 0;
+  std::deque<std::pair<Outcome, double>> latencies;
+  std::deque<StageStats> recentStats;
+};
+
+const size_t Server::kWindow;
+
+bool Server::admit(size_t id, Clock::time_point arrived,
+                   ComicResult& outRejection) {
+  std::unique_lock<std::mutex> lock{mutex};
+  const auto waiting = queue.size() + admitted;
+  if (waiting < queueLimit) {
+    admitted++;
+    return true;
+  }
+  rejected++;
+  lock.unlock();
+
+  outRejection = ComicResult{};
+  outRejection.log = "request " + std::to_string(id) + ": queue full (" +
+                     std::to_string(waiting) + " waiting), try again later\n";
+  remember(Outcome::Rejected, msSince(arrived), nullptr);
+  return false;
+}
+
+void Server::cancel() {
+  std::lock_guard<std::mutex> lock{mutex};
+  admitted--;
+}
+
+ComicResult Server::transcribe(std::vector<uchar> encoded, size_t id,
+                               Clock::time_point arrived,
+                               Clock::time_point deadline) {
+  auto job = std::make_shared<Job>();
+  job->encoded = std::move(encoded);
+  job->name = "request " + std::to_string(id);
+  job->deadline = deadline;
+
+  std::unique_lock<std::mutex> lock{mutex};
+  admitted--;
+  queue.push_back(job);
+  wake.notify_one();
+
+  if (!finished.wait_until(lock, deadline, [&] { return job->finished; })) {
+    // Whoever picks it up next drops it, or if it is already running its
+    // result goes nowhere
+    expired++;
+    lock.unlock();
+    const auto latencyMs = msSince(arrived);
+    remember(Outcome::Expired, latencyMs, nullptr);
+    auto result = ComicResult{};
+    result.log = job->name + ": deadline passed after " +
+                 std::to_string(latencyMs) + " ms\n";
+    return result;
+  }
+  served++;
+  lock.unlock();
+
+  remember(Outcome::Served, msSince(arrived), &job->result.stats);
+  return std::move(job->result);
+}
+
+void Server::workerLoop() {
+  while (true) {
+    auto job = std::shared_ptr<Job>{};
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      wake.wait(lock, [&] { return stopping || !queue.empty(); });
+      if (stopping) {
+        return;
+      }
+      job = queue.front();
+      queue.pop_front();
+      if (Clock::now() >= job->deadline) {
+        continue;
+      }
+      running++;
+    }
+
+    // Requests are already spread over the workers; matching within one comic
+    // stays serial
+    auto result =
+        runComic(models, job->encoded, job->name, settings, nullptr);
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      running--;
+      job->result = std::move(result);
+      job->finished = true;
+    }
+    finished.notify_all();
+  }
+}
+
+void Server::remember(Outcome outcome, double latencyMs,
+                      const StageStats* stats) {
+  std::lock_guard<std::mutex> lock{mutex};
+  latencies.emplace_back(outcome, latencyMs);
+  if (latencies.size() > kWindow) {
+    latencies.pop_front();
+  }
+  if (stats) {
+    recentStats.push_back(*stats);
+    if (recentStats.size() > kWindow) {
+      recentStats.pop_front();
+    }
+  }
+}
+
+namespace {
+
+void printLatencies(std::ostream& out, std::vector<double> sorted) {
+  std::sort(sorted.begin(), sorted.end());
+  out << "{\"requests\": " << sorted.size()
+      << ", \"p50\": " << percentile(sorted, 0.5)
+      << ", \"p90\": " << percentile(sorted, 0.9)
+      << ", \"p99\": " << percentile(sorted, 0.99)
+      << ", \"max\": " << percentile(sorted, 1.0) << "}";
+}
+
+}  // namespace
+
+void Server::printStats(std::ostream& out) {
+  auto all = std::vector<double>{};
+  auto servedOnly = std::vector<double>{};
+  auto summary = StatsSummary{};
+  std::unique_lock<std::mutex> lock{mutex};
+  out << "{\"queueDepth\": " << queue.size() << ", \"admitted\": " << admitted
+      << ", \"queueLimit\": " << queueLimit << ", \"running\": " << running
+      << ", \"workers\": " << threads.size() << ", \"served\": " << served
+      << ", \"rejected\": " << rejected << ", \"expired\": " << expired;
+  for (const auto& latency : latencies) {
+    all.push_back(latency.second);
+    if (latency.first == Outcome::Served) {
+      servedOnly.push_back(latency.second);
+    }
+  }
+  for (const auto& stats : recentStats) {
+    summary.add(stats);
+  }
+  lock.unlock();
+
+  // Rejected and expired requests are answered too, just not with a
+  // transcript, so they count towards the latency clients see
+  out << ", \"latencyMs\": ";
+  printLatencies(out, std::move(all));
+  out << ", \"servedLatencyMs\": ";
+  printLatencies(out, std::move(servedOnly));
+  out << ", \"stages\": ";
+  summary.printJson(out, true);
+  out << "}\n";
+}
+
+namespace {
+
+bool writeAll(int fd, const std::string& data) {
+  for (size_t done = 0; done < data.size();) {
+    auto n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+// Reads a request's image a piece at a time, so that memory goes to what a
+// client sends rather than what it claims it will send
+bool readPayload(FILE* in, size_t bytes, std::vector<uchar>& out) {
+  const size_t kPiece = 1 << 20;
+  out.clear();
+  while (out.size() < bytes) {
+    const auto done = out.size();
+    const auto n = std::min(kPiece, bytes - done);
+    out.resize(done + n);
+    if (fread(out.data() + done, 1, n, in) != n) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads past a turned away request's image to the next request
+bool skipPayload(FILE* in, size_t bytes) {
+  char buffer[64 << 10];
+  while (bytes > 0) {
+    const auto n = std::min(sizeof(buffer), bytes);
+    if (fread(buffer, 1, n, in) != n) {
+      return false;
+    }
+    bytes -= n;
+  }
+  return true;
+}
+
+// Answers one client's requests in order until it hangs up or sends something
+// malformed
+void serveConnection(int fd, Server& server, double defaultDeadlineMs,
+                     std::atomic<size_t>& nextId) {
+  auto in = fdopen(fd, "rb");
+  if (!in) {
+    close(fd);
+    return;
+  }
+
+  char* line = nullptr;
+  size_t lineCapacity = 0;
+  while (getline(&line, &lineCapacity, in) > 0) {
+    const auto arrived = Clock::now();
+    auto request = std::istringstream{line};
+    auto command = std::string{};
+    request >> command;
+
+    auto response = std::ostringstream{};
+    if (command == "stats") {
+      server.printStats(response);
+      if (!writeAll(fd, response.str())) {
+        break;
+      }
+      continue;
+    }
+
+    const auto id = nextId++;
+    auto bytes = size_t{0};
+    auto deadlineMs = defaultDeadlineMs;
+    if (command != "transcribe" || !(request >> bytes) ||
+        bytes > kMaxComicBytes) {
+      auto result = ComicResult{};
+      result.log = "request " + std::to_string(id) +
+                   ": expected \"transcribe <bytes> [<deadline ms>]\" or "
+                   "\"stats\"\n";
+      printComicJson(response, id, result);
+      writeAll(fd, response.str());
+      break;
+    }
+    request >> deadlineMs;
+
+    auto rejection = ComicResult{};
+    if (!server.admit(id, arrived, rejection)) {
+      printComicJson(response, id, rejection);
+      if (!skipPayload(in, bytes) || !writeAll(fd, response.str())) {
+        break;
+      }
+      continue;
+    }
+    auto encoded = std::vector<uchar>{};
+    if (!readPayload(in, bytes, encoded)) {
+      server.cancel();
+      break;
+    }
+
+    const auto deadline =
+        arrived + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double, std::milli>(deadlineMs));
+    printComicJson(response, id,
+                   server.transcribe(std::move(encoded), id, arrived,
+                                     deadline));
+    if (!writeAll(fd, response.str())) {
+      break;
+    }
+  }
+  free(line);
+  fclose(in);
+}
+
+}  // namespace
+
+// jerkcityd: loads the models once and transcribes comics sent to it over a
+// Unix socket. A connection carries any number of requests, each a line:
+//
+//   transcribe <bytes> [<deadline ms>]  followed by <bytes> of encoded image
+//   stats
+//
+// and each is answered in turn with one line of JSON: a comic record as
+// written by jerkcity --stream, or the server's stats.
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = po::options_description{"Allowed options"};
+  desc.add_options()("help", "this message")(
+      "socket", po::value<std::string>()->default_value("jerkcityd.sock"),
+      "path of the Unix socket to listen on (replaced if it exists)")(
+      "models", po::value<std::string>(),
+      "model bundle built by jerkcity-pack")(
+      "jobs", po::value<size_t>()->default_value(0),
+      "worker threads (0 = one per core)")(
+      "queue", po::value<size_t>()->default_value(64),
+      "requests that may wait for a worker before more are turned away")(
+      "deadline-ms", po::value<double>()->default_value(30000),
+      "how long a request may take unless it asks for something else")(
+      "connections", po::value<size_t>()->default_value(64),
+      "clients served at once; more wait to be accepted")(
+      "text-regions",
+      "only search for glyphs in the areas that look like text, rather than "
+      "the whole comic (faster, but untested against the corpus)")(
+      "match-engine", po::value<std::string>()->default_value("direct"),
+      "how glyph templates are matched: direct, fft or binary")(
+      "actor-engine", po::value<std::string>()->default_value("sift"),
+      "how speakers are recognized: sift, orb or sift-reference (the slow "
+      "matcher sift replaced)")(
+      "actor-cache-radius", po::value<int>()->default_value(-1),
+      "as for jerkcity; the cache lives as long as the server")(
+      "actor-cache-entries",
+      po::value<size_t>()->default_value(kDefaultActorCacheEntries),
+      "as for jerkcity");
+
+  auto vm = po::variables_map{};
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return -1;
+  }
+
+  const auto models =
+      loadModels(vm.count("models") ? vm["models"].as<std::string>() : "");
+  auto settings = RunSettings{};
+  settings.textRegions = vm.count("text-regions") != 0;
+  settings.matchEngine =
+      parseMatchEngine(vm["match-engine"].as<std::string>());
+  settings.actorEngine =
+      parseActorEngine(vm["actor-engine"].as<std::string>());
+  settings.stats = true;
+  auto cache = std::unique_ptr<ActorCache>{};
+  if (vm["actor-cache-radius"].as<int>() >= 0) {
+    cache.reset(new ActorCache{vm["actor-cache-radius"].as<int>(),
+                               vm["actor-cache-entries"].as<size_t>()});
+    settings.actorCache = cache.get();
+  }
+
+  auto jobs = vm["jobs"].as<size_t>();
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (jobs > 1) {
+    cv::setNumThreads(0);
+  }
+
+  const auto path = vm["socket"].as<std::string>();
+  auto address = sockaddr_un{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    throw std::runtime_error{"Socket path too long: " + path};
+  }
+  path.copy(address.sun_path, path.size());
+
+  const auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path.c_str());
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, SOMAXCONN) != 0) {
+    throw std::runtime_error{"Couldn't listen on " + path};
+  }
+  std::signal(SIGPIPE, SIG_IGN);
+
+  Server server{models, settings, jobs, vm["queue"].as<size_t>()};
+  const auto defaultDeadlineMs = vm["deadline-ms"].as<double>();
+  std::atomic<size_t> nextId{0};
+  std::cerr << "listening on " << path << " with " << jobs << " workers\n";
+
+  // A thread per connection, but only so many at once; the rest wait in the
+  // listen backlog
+  const auto maxConnections = std::max<size_t>(1, vm["connections"].as<size_t>());
+  std::mutex connectionsMutex;
+  std::condition_variable connectionClosed;
+  size_t connections = 0;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{connectionsMutex};
+      connectionClosed.wait(lock, [&] { return connections < maxConnections; });
+    }
+
+    const auto fd = accept(listener, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      // Most likely out of file descriptors, which won't change until some
+      // connections close, so don't spin
+      std::cerr << "accept: " << std::strerror(errno) << "\n";
+      std::this_thread::sleep_for(std::chrono::milliseconds{100});
+      continue;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{connectionsMutex};
+      connections++;
+    }
+    std::thread{[&, fd] {
+      serveConnection(fd, server, defaultDeadlineMs, nextId);
+      std::lock_guard<std::mutex> lock{connectionsMutex};
+      connections--;
+      connectionClosed.notify_one();
+    }}.detach();
+  }
+}
@@ -0,0 +1,53 @@
+#include "dictionary.h"
+
+#include "context.h"
+
+Dictionary::Dictionary(const std::set<std::string>& words) {
+  // Keep the table at most half full so probe runs stay short
+  uint32_t slotCount = 2;
+  while (slotCount < 2 * words.size() + 1) {
+    slotCount *= 2;
+  }
+
+  auto newSlots = std::make_shared<std::vector<uint32_t>>(slotCount, 0);
+  auto newText = std::make_shared<std::string>();
+
+  for (const auto& word : words) {
+    // Such words could never be looked up
+    if (word.empty() || word.find('\0') != std::string::npos ||
+        std::any_of(word.begin(), word.end(),
+                    [](char c) { return lower(c) != c; })) {
+      continue;
+    }
+
+    auto slot = hash(word.begin(), word.end()) & (slotCount - 1);
+    while ((*newSlots)[slot] != 0) {
+      slot = (slot + 1) & (slotCount - 1);
+    }
+    (*newSlots)[slot] = newText->size() + 1;
+    *newText += word;
+    *newText += '\0';
+  }
+
+  ownedSlots = newSlots;
+  ownedText = newText;
+  slots = ownedSlots->data();
+  numSlots = slotCount;
+  text = ownedText->data();
+  textLength = ownedText->size();
+}
+
+Dictionary::Dictionary(const uint32_t* slots_, uint32_t slotCount_,
+                       const char* text_, uint32_t textSize_)
+    : slots{slots_}, numSlots{slotCount_}, text{text_}, textLength{textSize_} {
+  ASSERT(numSlots == 0 || (numSlots & (numSlots - 1)) == 0,
+         ": dictionary size must be a power of two");
+  uint32_t empty = 0;
+  for (uint32_t i = 0; i < numSlots; i++) {
+    ASSERT(slots[i] <= textLength, ": dictionary is corrupt");
+    empty += slots[i] == 0;
+  }
+  ASSERT(numSlots == 0 || empty > 0, ": dictionary is full");
+  ASSERT(textLength == 0 || text[textLength - 1] == '\0',
+         ": dictionary is corrupt");
+}
@@ -0,0 +1,87 @@
+#ifndef _DICTIONARY_H_
+#define _DICTIONARY_H_
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+// A read-only set of lower case words. It is an open addressing hash table of
+// offsets into one block of NUL terminated words, so it can be written to a
+// model bundle and used straight out of the mapping. Lookups ignore case and
+// don't allocate.
+class Dictionary {
+ public:
+  Dictionary() = default;
+  explicit Dictionary(const std::set<std::string>& words);
+
+  // Wraps tables built by the above, e.g. mapped from a bundle. They must
+  // outlive this.
+  Dictionary(const uint32_t* slots_, uint32_t slotCount_, const char* text_,
+             uint32_t textSize_);
+
+  // Is the word spelled by the chars in [begin, end) in the dictionary?
+  template <class It>
+  bool contains(It begin, It end) const;
+
+  bool contains(const std::string& word) const {
+    return contains(word.begin(), word.end());
+  }
+
+  // The raw tables, for writing out
+  const uint32_t* slotData() const { return slots; }
+  uint32_t slotCount() const { return numSlots; }
+  const char* textData() const { return text; }
+  uint32_t textSize() const { return textLength; }
+
+ private:
+  static char lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+  // FNV-1a over the lower cased chars
+  template <class It>
+  static uint32_t hash(It begin, It end);
+
+  std::shared_ptr<const std::vector<uint32_t>> ownedSlots;
+  std::shared_ptr<const std::string> ownedText;
+
+  // Each slot is 1 + the offset of a word in text, or 0 if empty. There is
+  // always at least one empty slot.
+  const uint32_t* slots = nullptr;
+  uint32_t numSlots = 0;  // a power of two
+  const char* text = nullptr;
+  uint32_t textLength = 0;
+};
+
+template <class It>
+uint32_t Dictionary::hash(It begin, It end) {
+  uint32_t h = 2166136261u;
+  for (auto it = begin; it != end; ++it) {
+    h = (h ^ static_cast<uint8_t>(lower(*it))) * 16777619u;
+  }
+  return h;
+}
+
+template <class It>
+bool Dictionary::contains(It begin, It end) const {
+  if (numSlots == 0) {
+    return false;
+  }
+
+  const auto mask = numSlots - 1;
+  for (auto slot = hash(begin, end) & mask; slots[slot] != 0;
+       slot = (slot + 1) & mask) {
+    auto word = text + slots[slot] - 1;
+    auto it = begin;
+    while (it != end && *word != '\0' && *word == lower(*it)) {
+      ++it;
+      ++word;
+    }
+    if (it == end && *word == '\0') {
+      return true;
+    }
+  }
+  return false;
+}
+
+#endif
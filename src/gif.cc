@@ -0,0 +1,276 @@
+#include "gif.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+
+namespace {
+
+const size_t kMaxCodes = 4096;  // 12 bit LZW codes
+
+// Walks the file, throwing rather than reading past the end
+class Reader {
+ public:
+  explicit Reader(const std::vector<uchar>& data_) : data(data_) {}
+
+  uchar byte() {
+    need(1);
+    return data[pos++];
+  }
+  int u16() {
+    need(2);
+    pos += 2;
+    return data[pos - 2] | data[pos - 1] << 8;
+  }
+  void skip(size_t n) {
+    need(n);
+    pos += n;
+  }
+  const uchar* take(size_t n) {
+    need(n);
+    pos += n;
+    return &data[pos - n];
+  }
+  // Extensions and image data are chains of sub-blocks of up to 255 bytes,
+  // ended by an empty one
+  void skipSubBlocks() {
+    while (auto size = byte()) {
+      skip(size);
+    }
+  }
+
+ private:
+  void need(size_t n) const {
+    if (data.size() - pos < n) {
+      throw std::runtime_error{"Truncated GIF"};
+    }
+  }
+
+  const std::vector<uchar>& data;
+  size_t pos = 0;
+};
+
+struct Palette {
+  uchar grey[256] = {};
+  cv::Vec3b bgr[256];
+};
+
+Palette readPalette(Reader& in, size_t entries) {
+  auto palette = Palette{};
+  for (size_t i = 0; i < entries; i++) {
+    const int r = in.byte();
+    const int g = in.byte();
+    const int b = in.byte();
+    // 0.299, 0.587 and 0.114 in 15 bit fixed point, which sum to exactly 1 so
+    // that greys map to themselves
+    palette.grey[i] =
+        static_cast<uchar>((9798 * r + 19235 * g + 3735 * b + 16384) >> 15);
+    palette.bgr[i] = cv::Vec3b(b, g, r);
+  }
+  return palette;
+}
+
+// Which output row the n'th decoded row is. Interlaced frames come in four
+// passes: every 8th row from 0, every 8th from 4, every 4th from 2, every
+// 2nd from 1.
+std::vector<int> rowOrder(int height, bool interlaced) {
+  std::vector<int> rows;
+  if (!interlaced) {
+    for (auto y = 0; y < height; y++) {
+      rows.push_back(y);
+    }
+    return rows;
+  }
+  const int starts[] = {0, 4, 2, 1};
+  const int steps[] = {8, 8, 4, 2};
+  for (auto pass = 0; pass < 4; pass++) {
+    for (auto y = starts[pass]; y < height; y += steps[pass]) {
+      rows.push_back(y);
+    }
+  }
+  return rows;
+}
+
+}  // namespace
+
+bool isGif(const std::vector<uchar>& data) {
+  return data.size() >= 6 &&
+         (std::equal(data.begin(), data.begin() + 6, "GIF87a") ||
+          std::equal(data.begin(), data.begin() + 6, "GIF89a"));
+}
+
+bool isGifFile(const std::string& file) {
+  std::ifstream in{file, std::ios::binary};
+  auto header = std::vector<uchar>(6);
+  in.read(reinterpret_cast<char*>(header.data()), header.size());
+  return in && isGif(header);
+}
+
+void decodeGif(const std::vector<uchar>& data, cv::Mat& outGrey,
+               cv::Mat* outColour) {
+  if (!isGif(data)) {
+    throw std::runtime_error{"Not a GIF"};
+  }
+  auto in = Reader{data};
+  in.skip(6);
+
+  // Logical screen descriptor
+  in.u16();
+  in.u16();
+  const auto screenFlags = in.byte();
+  in.skip(2);  // background colour, aspect ratio
+  auto palette = Palette{};
+  if (screenFlags & 0x80) {
+    palette = readPalette(in, size_t{2} << (screenFlags & 7));
+  }
+
+  // Skip extensions up to the first image descriptor
+  while (true) {
+    const auto block = in.byte();
+    if (block == 0x2c) {
+      break;
+    }
+    if (block != 0x21) {
+      throw std::runtime_error{"No image in GIF"};
+    }
+    in.byte();  // label
+    in.skipSubBlocks();
+  }
+
+  // The frame's own pixels, ignoring where it sits on the screen, as convert
+  // does
+  in.skip(4);
+  const auto width = in.u16();
+  const auto height = in.u16();
+  const auto imageFlags = in.byte();
+  if (imageFlags & 0x80) {
+    palette = readPalette(in, size_t{2} << (imageFlags & 7));
+  }
+  if (width == 0 || height == 0) {
+    throw std::runtime_error{"Empty GIF"};
+  }
+  const auto rows = rowOrder(height, (imageFlags & 0x40) != 0);
+
+  outGrey.create(height, width, CV_8UC1);
+  if (outColour) {
+    outColour->create(height, width, CV_8UC3);
+  }
+
+  const int minCodeSize = in.byte();
+  if (minCodeSize < 2 || minCodeSize > 8) {
+    throw std::runtime_error{"Bad LZW code size in GIF"};
+  }
+  const auto clearCode = 1 << minCodeSize;
+  const auto endCode = clearCode + 1;
+
+  // Each code is a string: the code before it plus one last index
+  uint16_t prefix[kMaxCodes];
+  uchar suffix[kMaxCodes];
+  uchar stack[kMaxCodes];
+  for (auto code = 0; code < clearCode; code++) {
+    prefix[code] = 0;
+    suffix[code] = static_cast<uchar>(code);
+  }
+
+  auto codeSize = minCodeSize + 1;
+  auto nextCode = endCode + 1;
+  auto prevCode = -1;
+  uchar firstIndex = 0;  // of the previous code's string
+
+  uint32_t bits = 0;
+  auto bitCount = 0;
+
+  auto x = 0;
+  size_t row = 0;
+  uchar* grey = outGrey.ptr<uchar>(rows[0]);
+  cv::Vec3b* colour = outColour ? outColour->ptr<cv::Vec3b>(rows[0]) : nullptr;
+  auto emit = [&](uchar index) {
+    if (row == rows.size()) {
+      return;  // extra data past the last row is ignored
+    }
+    grey[x] = palette.grey[index];
+    if (colour) {
+      colour[x] = palette.bgr[index];
+    }
+    if (++x == width) {
+      x = 0;
+      if (++row < rows.size()) {
+        grey = outGrey.ptr<uchar>(rows[row]);
+        if (colour) {
+          colour = outColour->ptr<cv::Vec3b>(rows[row]);
+        }
+      }
+    }
+  };
+
+  auto ended = false;
+  while (auto blockSize = in.byte()) {
+    const auto* block = in.take(blockSize);
+    for (auto i = 0; i < blockSize && !ended; i++) {
+      bits |= uint32_t{block[i]} << bitCount;
+      bitCount += 8;
+
+      while (bitCount >= codeSize) {
+        auto code = static_cast<int>(bits & ((1u << codeSize) - 1));
+        bits >>= codeSize;
+        bitCount -= codeSize;
+
+        if (code == clearCode) {
+          codeSize = minCodeSize + 1;
+          nextCode = endCode + 1;
+          prevCode = -1;
+          continue;
+        }
+        if (code == endCode) {
+          ended = true;
+          break;
+        }
+
+        if (prevCode == -1) {
+          if (code >= clearCode) {
+            throw std::runtime_error{"Bad LZW code in GIF"};
+          }
+          emit(static_cast<uchar>(code));
+          prevCode = code;
+          firstIndex = static_cast<uchar>(code);
+          continue;
+        }
+
+        const auto thisCode = code;
+        size_t depth = 0;
+        if (code >= nextCode) {
+          // The one code that can be used as it is being defined: the
+          // previous string plus its own first index
+          if (code > nextCode) {
+            throw std::runtime_error{"Bad LZW code in GIF"};
+          }
+          stack[depth++] = firstIndex;
+          code = prevCode;
+        }
+        while (code >= clearCode) {
+          stack[depth++] = suffix[code];
+          code = prefix[code];
+        }
+        firstIndex = static_cast<uchar>(code);
+        stack[depth++] = firstIndex;
+        while (depth > 0) {
+          emit(stack[--depth]);
+        }
+
+        if (nextCode < static_cast<int>(kMaxCodes)) {
+          prefix[nextCode] = static_cast<uint16_t>(prevCode);
+          suffix[nextCode] = firstIndex;
+          nextCode++;
+          if (nextCode == 1 << codeSize && codeSize < 12) {
+            codeSize++;
+          }
+        }
+        prevCode = thisCode;
+      }
+    }
+  }
+
+  if (row < rows.size()) {
+    throw std::runtime_error{"Truncated GIF image data"};
+  }
+}
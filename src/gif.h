@@ -0,0 +1,22 @@
+#ifndef _GIF_H_
+#define _GIF_H_
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// The archive's comics are GIFs. Decoding them here skips converting each one
+// to a PNG first and reading it back twice (grey, then colour for debugging).
+
+bool isGif(const std::vector<uchar>& data);
+bool isGifFile(const std::string& file);
+
+// Decodes the first frame in a single pass, straight through the palette into
+// an 8 bit grey image. Grey palette entries keep their value, colours are
+// weighted as imread weighs them. If `outColour` is given it gets the frame in
+// BGR from the same pass. Throws on anything malformed or truncated.
+void decodeGif(const std::vector<uchar>& data, cv::Mat& outGrey,
+               cv::Mat* outColour);
+
+#endif
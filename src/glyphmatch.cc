@@ -0,0 +1,52 @@
+#include "glyphmatch.h"
+
+namespace {
+
+class DirectGlyphMatcher : public GlyphMatcher {
+ public:
+  DirectGlyphMatcher(const cv::Mat& img_, const std::vector<cv::Rect>& regions_,
+                     const std::vector<Template>& templates_)
+      : img{img_}, regions{regions_}, templates{templates_} {}
+
+  cv::Mat match(size_t tmpl, size_t region) const override {
+    auto atlas = cv::Mat{};
+    cv::matchTemplate(cv::Mat{img, regions[region]}, templates[tmpl].img,
+                      atlas, CV_TM_SQDIFF);
+    return atlas;
+  }
+
+ private:
+  cv::Mat img;
+  std::vector<cv::Rect> regions;
+  const std::vector<Template>& templates;
+};
+
+}  // namespace
+
+MatchEngine parseMatchEngine(const std::string& name) {
+  if (name == "direct") {
+    return MatchEngine::Direct;
+  }
+  if (name == "fft") {
+    return MatchEngine::Fft;
+  }
+  if (name == "binary") {
+    return MatchEngine::Binary;
+  }
+  throw std::runtime_error{"Unknown match engine: " + name};
+}
+
+std::unique_ptr<GlyphMatcher> makeGlyphMatcher(
+    MatchEngine engine, const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models) {
+  switch (engine) {
+    case MatchEngine::Direct:
+      return std::unique_ptr<GlyphMatcher>{
+          new DirectGlyphMatcher{img, regions, models.glyphs}};
+    case MatchEngine::Fft:
+      return makeFftGlyphMatcher(img, regions, models);
+    case MatchEngine::Binary:
+      return makeBinaryGlyphMatcher(img, regions, models);
+  }
+  throw std::runtime_error{"Unknown match engine"};
+}
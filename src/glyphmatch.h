@@ -0,0 +1,40 @@
+#ifndef _GLYPHMATCH_H_
+#define _GLYPHMATCH_H_
+
+#include "context.h"
+
+// A SQDIFF score below this is considered a match
+const float kCharMatchThresh = 100000.0;
+
+// Computes CV_TM_SQDIFF match atlases for every glyph template over a fixed set
+// of regions of one comic. Whatever can be shared between templates is done up
+// front, after which match() may be called from several threads at once.
+class GlyphMatcher {
+ public:
+  virtual ~GlyphMatcher() {}
+
+  // Same size and (within float rounding) contents as
+  // cv::matchTemplate(img(regions[region]), templates[tmpl].img, CV_TM_SQDIFF),
+  // except that positions that can't score below kCharMatchThresh may hold any
+  // value at or above it. The template must fit in the region.
+  virtual cv::Mat match(size_t tmpl, size_t region) const = 0;
+};
+
+// "direct", "fft" or "binary"
+MatchEngine parseMatchEngine(const std::string& name);
+
+std::unique_ptr<GlyphMatcher> makeGlyphMatcher(
+    MatchEngine engine, const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models);
+
+std::unique_ptr<GlyphMatcher> makeFftGlyphMatcher(
+    const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models);
+// The POPCNT/AVX2 build of the scan is used where the CPU has both, unless
+// `allowSimd` is false (for benchmarking the portable one)
+std::unique_ptr<GlyphMatcher> makeBinaryGlyphMatcher(
+    const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models, bool allowSimd = true);
+bool binaryGlyphMatcherHasSimd();
+
+#endif
@@ -0,0 +1,161 @@
+#include "groundtruth.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+void replaceAll(std::string& str, const std::string& from,
+                const std::string& to) {
+  for (auto pos = str.find(from); pos != std::string::npos;
+       pos = str.find(from, pos + to.size())) {
+    str.replace(pos, from.size(), to);
+  }
+}
+
+void dropTrailingNewlines(std::string& str) {
+  while (!str.empty() && str.back() == '\n') {
+    str.pop_back();
+  }
+}
+
+// Lines counted the way `echo "$str" | wc -l` does
+size_t lineCount(const std::string& str) {
+  return std::count(str.begin(), str.end(), '\n') + 1;
+}
+
+}  // namespace
+
+// dialog.xml has one element per line, so it's read line by line rather than
+// with a real XML parser
+GroundTruth::GroundTruth(const std::string& file) {
+  std::ifstream fin{file};
+  if (!fin) {
+    throw std::runtime_error{"Couldn't open: " + file};
+  }
+
+  const auto kIssuePrefix = std::string{"<issue num=\""};
+  auto issue = -1;
+  auto inDialog = false;
+  auto dialog = std::string{};
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (line.compare(0, kIssuePrefix.size(), kIssuePrefix) == 0) {
+      issue = std::stoi(line.substr(kIssuePrefix.size()));
+    } else if (line == "<dialog>") {
+      inDialog = true;
+      dialog.clear();
+    } else if (line == "</dialog>") {
+      if (issue < 0) {
+        throw std::runtime_error{"Dialog outside of an issue in " + file};
+      }
+      replaceAll(dialog, "&gt;", ">");
+      replaceAll(dialog, "&lt;", "<");
+      replaceAll(dialog, "&amp;", "&");
+      dropTrailingNewlines(dialog);
+      dialogs[issue] = dialog;
+      inDialog = false;
+    } else if (inDialog) {
+      dialog += line + "\n";
+    }
+  }
+}
+
+const std::string* GroundTruth::dialog(int issue) const {
+  auto it = dialogs.find(issue);
+  return it != dialogs.end() ? &it->second : nullptr;
+}
+
+std::vector<int> GroundTruth::issues() const {
+  std::vector<int> result;
+  for (const auto& entry : dialogs) {
+    result.push_back(entry.first);
+  }
+  return result;
+}
+
+const char* verdictName(Verdict verdict) {
+  switch (verdict) {
+    case Verdict::Failed:
+      return "failed";
+    case Verdict::NoExpected:
+      return "no expected data";
+    case Verdict::LineCount:
+      return "line count mismatch";
+    case Verdict::Dialog:
+      return "incorrect dialog";
+    case Verdict::Cast:
+      return "incorrect cast";
+    case Verdict::Pass:
+      return "pass";
+  }
+  return "?";
+}
+
+std::string normalizeTranscript(const std::string& transcript) {
+  auto in = std::istringstream{transcript};
+  auto out = std::string{};
+  std::string line;
+  while (std::getline(in, line)) {
+    auto first = line.find_first_not_of(' ');
+    if (first != std::string::npos) {
+      out += line.substr(first, line.find_last_not_of(' ') - first + 1);
+    }
+    out += "\n";
+  }
+  dropTrailingNewlines(out);
+  return out;
+}
+
+std::string dialogWords(const std::string& transcript) {
+  auto in = std::istringstream{transcript};
+  auto out = std::string{};
+  std::string line;
+  while (std::getline(in, line)) {
+    // Only a colon that is the first on the line and followed by a space ends
+    // an actor's name
+    auto colon = line.find(':');
+    if (colon != std::string::npos && colon + 1 < line.size() &&
+        line[colon + 1] == ' ') {
+      line.erase(0, colon + 2);
+    }
+    out += line + "\n";
+  }
+  dropTrailingNewlines(out);
+  return out;
+}
+
+Verdict judge(const std::string& expected, const std::string& actual) {
+  if (expected.empty()) {
+    return Verdict::NoExpected;
+  }
+  if (lineCount(expected) != lineCount(actual)) {
+    return Verdict::LineCount;
+  }
+  if (dialogWords(expected) != dialogWords(actual)) {
+    return Verdict::Dialog;
+  }
+  if (expected != actual) {
+    return Verdict::Cast;
+  }
+  return Verdict::Pass;
+}
+
+size_t editDistance(const std::string& a, const std::string& b) {
+  std::vector<size_t> prev(b.size() + 1);
+  std::vector<size_t> cur(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); j++) {
+    prev[j] = j;
+  }
+  for (size_t i = 1; i <= a.size(); i++) {
+    cur[0] = i;
+    for (size_t j = 1; j <= b.size(); j++) {
+      cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1,
+                         prev[j - 1] + (a[i - 1] == b[j - 1] ? 0 : 1)});
+    }
+    std::swap(prev, cur);
+  }
+  return prev[b.size()];
+}
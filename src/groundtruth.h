@@ -0,0 +1,51 @@
+#ifndef _GROUNDTRUTH_H_
+#define _GROUNDTRUTH_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+// The expected dialog of every issue in tests/dialog.xml, read once and indexed
+// by issue number. Dialog is one "actor: WORDS" line per bubble (narration has
+// no actor), entities decoded, without a trailing newline.
+class GroundTruth {
+ public:
+  explicit GroundTruth(const std::string& file);
+
+  // Null if the issue isn't in the file
+  const std::string* dialog(int issue) const;
+
+  // Every issue in the file, ascending
+  std::vector<int> issues() const;
+
+ private:
+  std::map<int, std::string> dialogs;
+};
+
+// How a transcript compares to the expected dialog, from worst to best. These
+// are the buckets tests/test.sh sorts issues into.
+enum class Verdict {
+  Failed,      // the pipeline threw, or took too long
+  NoExpected,  // nothing to compare against
+  LineCount,   // a different number of bubbles
+  Dialog,      // the same number of bubbles, but some words differ
+  Cast,        // all the words are right, some actors aren't
+  Pass,
+};
+
+const char* verdictName(Verdict verdict);
+
+// Trims spaces off each line and drops trailing newlines, as the test script
+// does with jerkcity's output
+std::string normalizeTranscript(const std::string& transcript);
+
+// The transcript without the "actor: " prefixes
+std::string dialogWords(const std::string& transcript);
+
+// Compares a normalized transcript against the expected dialog
+Verdict judge(const std::string& expected, const std::string& actual);
+
+// Levenshtein distance, for character error rates
+size_t editDistance(const std::string& a, const std::string& b);
+
+#endif
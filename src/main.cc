@@ -1,58 +1,63 @@
+#include "actorcache.h"
+#include "actors.h"
 #include "context.h"
+#include "corpus.h"
+#include "glyphmatch.h"
+#include "overlay.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "stats.h"
+#include "stream.h"
 
+#include <fstream>
 #include <iostream>
 
+#include <glob.h>
+
+#include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 
-#include <opencv2/highgui/highgui.hpp>
+namespace fs = boost::filesystem;
 
-void findPanels(Context& ctx);
-void untypeset(Context& ctx);
-void attributeDialog(Context& ctx);
+// Expands a --batch argument into a list of comics. The argument can be a
+// directory (every .png and .gif in it), a glob pattern or a file with one path per
+// line.
+std::vector<std::string> listInputs(const std::string& spec) {
+  std::vector<std::string> inputs;
 
-Context::Context(const std::string& file, bool debug_) : debug{debug_} {
-  img = cv::imread(file, CV_LOAD_IMAGE_GRAYSCALE);
-  if (img.dims == 0) {
-    throw std::runtime_error{"Couldn't load: " + file};
+  if (fs::is_directory(spec)) {
+    for (auto fIt = fs::directory_iterator{spec};
+         fIt != fs::directory_iterator{}; ++fIt) {
+      auto file = fs::path{*fIt};
+      if (fs::is_regular_file(file) &&
+          (file.extension() == ".png" || file.extension() == ".gif")) {
+        inputs.push_back(file.string());
+      }
+    }
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
   }
 
-  if (debug) {
-    debugImg = cv::imread(file, CV_LOAD_IMAGE_COLOR);
-    if (debugImg.dims == 0) {
-      throw std::runtime_error{"Couldn't load debug image: " + file};
+  if (spec.find_first_of("*?[") != std::string::npos) {
+    glob_t matches;
+    if (glob(spec.c_str(), 0, nullptr, &matches) == 0) {
+      inputs.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
     }
+    globfree(&matches);
+    return inputs;
   }
-}
 
-void saveDebug(const Context& ctx, const std::string& file) {
-  if (ctx.debug) {
-    cv::imwrite(file.c_str(), ctx.debugImg);
+  std::ifstream fin{spec};
+  if (!fin) {
+    throw std::runtime_error{"Couldn't open batch list: " + spec};
   }
-}
-
-void hackOutStarringPanel(Context& ctx) {
-  ctx.panels[0]
-      .dialog.clear();  // TODO: are there any comics where this is wrong?
-}
-
-void printComic(Context& ctx) {
-  for (const auto& panel : ctx.panels) {
-    for (const auto& bubble : panel.dialog) {
-      if (bubble.actor != "") {
-        std::cout << bubble.actor << ": ";
-      }
-      std::cout << bubble.contents << "\n";
+  std::string line;
+  while (std::getline(fin, line)) {
+    if (!line.empty()) {
+      inputs.push_back(line);
     }
   }
-}
-
-void process(Context& ctx) {
-  findPanels(ctx);
-  untypeset(ctx);
-  attributeDialog(ctx);
-  hackOutStarringPanel(ctx);
-
-  printComic(ctx);
+  return inputs;
 }
 
 int main(int argc, char** argv) {
@@ -61,8 +66,51 @@ int main(int argc, char** argv) {
   desc.add_options()("help", "this message")(
       "debug-json", "print JSON formatted debug data to stderr")(
       "debug-file", po::value<std::string>(),
-      "file to store a .png with debug output")(
-      "input-file", po::value<std::string>(), "input comic in png format");
+      "file to store a .png with debug output (a directory in batch and stream "
+      "mode). The drawing is recorded while the comic is processed and "
+      "rendered afterwards on a thread of its own.")(
+      "debug-stages", po::value<std::string>()->default_value("all"),
+      "which stages' drawing goes in the debug output: all, or some of "
+      "panels,textRegions,glyphs,words,lines,bubbles,garbageLines")(
+      "debug-failures",
+      "only write debug output for comics that fail")(
+      "input-file", po::value<std::string>(), "input comic in png or gif format")(
+      "models", po::value<std::string>(),
+      "model bundle built by jerkcity-pack (default: jerkcity.bundle next to "
+      "this binary if present, otherwise the glyphs/ and actors/ dirs)")(
+      "batch", po::value<std::string>(),
+      "directory, glob or file listing input comics to process in one run")(
+      "stream",
+      "read comics from stdin, each a 4 byte big-endian length followed by "
+      "the encoded image, and write one line of JSON per comic to stdout; "
+      "exits 2 if stdin ends part way through a comic")(
+      "jobs", po::value<size_t>()->default_value(0),
+      "worker threads for batch mode (0 = one per core)")(
+      "threads", po::value<size_t>()->default_value(0),
+      "threads to spread a single comic's glyph matching over, with "
+      "--input-file or --stream (0 = one per core)")(
+      "text-regions",
+      "only search for glyphs in the areas that look like text, rather than "
+      "the whole comic (faster, but untested against the corpus)")(
+      "match-engine", po::value<std::string>()->default_value("direct"),
+      "how glyph templates are matched: direct, fft or binary")(
+      "actor-engine", po::value<std::string>()->default_value("sift"),
+      "how speakers are recognized: sift, orb or sift-reference (the slow "
+      "matcher sift replaced)")(
+      "stats-json",
+      "print each comic's stage timings and counters to stderr as a line of "
+      "JSON, followed in batch mode by a summary of the whole run")(
+      "actor-cache", po::value<std::string>(),
+      "file to keep recognized actor windows in between runs (ignored if it "
+      "was saved with other actor templates)")(
+      "actor-cache-radius", po::value<int>()->default_value(-1),
+      "reuse the actor of a cached window whose hash differs from a window's "
+      "by at most this many bits (negative = no cache). Trades exact "
+      "speaker recognition for speed; in batch mode the answers also depend "
+      "on which comic reaches a window first.")(
+      "actor-cache-entries",
+      po::value<size_t>()->default_value(kDefaultActorCacheEntries),
+      "most windows the actor cache holds before dropping the oldest");
 
   auto po_desc = po::positional_options_description{};
 
@@ -74,34 +122,183 @@ int main(int argc, char** argv) {
             vm);
   po::notify(vm);
 
-  if (vm.count("help") || !vm.count("input-file")) {
+  if (vm.count("help") ||
+      (!vm.count("input-file") && !vm.count("batch") && !vm.count("stream"))) {
     std::cout << desc << "\n";
     return -1;
   }
 
-  const auto& inFile = vm["input-file"].as<std::string>();
-
-  auto ctx = Context{inFile, vm.count("debug-file") != 0};
-  ctx.debugJson = vm.count("debug-json") != 0;
-
+  auto loadStart = std::chrono::steady_clock::now();
+  const auto models = loadModels(
+      vm.count("models") ? vm["models"].as<std::string>() : "");
+  const auto loadMs = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - loadStart)
+                          .count();
+  auto settings = RunSettings{};
+  settings.debugJson = vm.count("debug-json") != 0;
+  settings.textRegions = vm.count("text-regions") != 0;
+  settings.matchEngine =
+      parseMatchEngine(vm["match-engine"].as<std::string>());
+  settings.actorEngine =
+      parseActorEngine(vm["actor-engine"].as<std::string>());
+  // Stream records always carry their timings
+  settings.stats = vm.count("stats-json") || vm.count("stream");
   const std::string debugFile =
       vm.count("debug-file") ? vm["debug-file"].as<std::string>() : "";
+  settings.debugOverlay = debugFile != "";
+  const auto debugFailures = vm.count("debug-failures") != 0;
+  // Declared before anything that queues onto it, so everything is written
+  // before main returns
+  auto debugWriter = std::unique_ptr<DebugWriter>{};
+  if (debugFile != "") {
+    debugWriter.reset(new DebugWriter{
+        parseDebugStages(vm["debug-stages"].as<std::string>())});
+  }
+  auto wantDebug = [&](const ComicResult& result) {
+    return debugWriter && !(debugFailures && result.ok);
+  };
 
-  if (ctx.debugJson) {
-    std::cerr << "{\n";
+  const auto cacheRadius = vm["actor-cache-radius"].as<int>();
+  const std::string cacheFile =
+      vm.count("actor-cache") ? vm["actor-cache"].as<std::string>() : "";
+  auto cache = std::unique_ptr<ActorCache>{};
+  if (cacheRadius >= 0) {
+    cache.reset(new ActorCache{cacheRadius,
+                               vm["actor-cache-entries"].as<size_t>()});
+    if (cacheFile != "" &&
+        !cache->load(cacheFile, actorTemplatesHash(models))) {
+      std::cerr << cacheFile
+                << ": saved with other actor templates, starting afresh\n";
+    }
+    settings.actorCache = cache.get();
   }
+  // Persists the cache and reports how much it saved. Only worth the noise on
+  // stderr when comics are being shared between.
+  auto finishCache = [&] {
+    if (!cache ||
+        (cacheFile == "" && !vm.count("batch") && !vm.count("stream"))) {
+      return;
+    }
+    if (cacheFile != "") {
+      cache->save(cacheFile, actorTemplatesHash(models));
+    }
+    auto stats = cache->stats();
+    auto lookups = std::max<size_t>(1, stats.hits + stats.misses);
+    std::cerr << "actor cache: " << stats.hits << " hits, " << stats.misses
+              << " misses (" << 100.0 * stats.hits / lookups << "% hit rate), "
+              << 1000.0 * stats.lookupMs / lookups << " us per lookup, "
+              << stats.entries << " entries, " << stats.evictions
+              << " evicted\n";
+  };
 
-  try {
-    process(ctx);
+  // A pool for fanning out within one comic, for the modes that run one at a
+  // time
+  auto comicPool = [&] {
+    auto threads = vm["threads"].as<size_t>();
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto pool = std::unique_ptr<WorkStealingPool>{};
+    if (threads > 1) {
+      pool.reset(new WorkStealingPool{threads});
+      cv::setNumThreads(0);
+    }
+    return pool;
+  };
+
+  if (vm.count("input-file")) {
+    const auto& inFile = vm["input-file"].as<std::string>();
+    auto pool = comicPool();
+    auto result = runComic(models, inFile, settings, pool.get());
+    finishCache();
+    std::cerr << result.log;
+    if (settings.stats) {
+      result.stats.ms["loadModels"] = loadMs;
+      printStatsJson(std::cerr, inFile, result.stats);
+    }
+    std::cout << result.transcript << std::flush;
+    if (wantDebug(result)) {
+      debugWriter->write(inFile, std::move(result.overlay), debugFile);
+    }
+    return result.ok ? 0 : 1;
   }
-  catch (...) {
-    saveDebug(ctx, debugFile);
-    throw;
+
+  if (vm.count("stream")) {
+    auto pool = comicPool();
+    auto failures = 0;
+    // Everything before a framing error has been answered already, but what
+    // follows it can't be found, so give up on the rest of the stream
+    try {
+      transcribeStream(
+        std::cin, std::cout,
+        [&](size_t index, const std::vector<uchar>& encoded) {
+          auto result =
+              runComic(models, encoded, "comic " + std::to_string(index),
+                       settings, pool.get());
+          if (!result.ok) {
+            failures++;
+          }
+          if (wantDebug(result)) {
+            debugWriter->write(
+                encoded, std::move(result.overlay),
+                (fs::path{debugFile} / (std::to_string(index) + ".debug.png"))
+                    .string());
+          }
+          return result;
+        });
+    }
+    catch (const std::exception& e) {
+      finishCache();
+      std::cerr << "stdin: " << e.what() << "\n";
+      return 2;
+    }
+    finishCache();
+    return failures == 0 ? 0 : 1;
   }
 
-  if (ctx.debugJson) {
-    std::cerr << "}";
+  auto jobs = vm["jobs"].as<size_t>();
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
   }
+  if (jobs > 1) {
+    // We already have one comic per core, don't let OpenCV fan out on top
+    cv::setNumThreads(0);
+  }
+
+  auto failures = 0;
+  auto summary = StatsSummary{};
+  summary.addRunTime("loadModels", loadMs);
+  WorkStealingPool pool{jobs};
+  transcribeCorpus(
+      pool, listInputs(vm["batch"].as<std::string>()),
+      [&](const std::string& inFile) {
+        // Comics are already spread over the pool; matching within one comic
+        // stays serial
+        auto result = runComic(models, inFile, settings, nullptr);
+        if (wantDebug(result)) {
+          debugWriter->write(
+              inFile, std::move(result.overlay),
+              (fs::path{debugFile} / fs::path{inFile}.stem()).string() +
+                  ".debug.png");
+        }
+        return result;
+      },
+      [&](const std::string& inFile, const ComicResult& result) {
+        std::cerr << result.log;
+        if (settings.stats) {
+          printStatsJson(std::cerr, inFile, result.stats);
+          summary.add(result.stats);
+        }
+        std::cout << "==> " << inFile << " <==\n" << result.transcript
+                  << std::flush;
+        if (!result.ok) {
+          failures++;
+        }
+      });
 
-  saveDebug(ctx, debugFile);
+  finishCache();
+  if (settings.stats) {
+    summary.printJson(std::cerr);
+  }
+  return failures == 0 ? 0 : 1;
 }
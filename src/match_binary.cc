@@ -0,0 +1,231 @@
+#include "glyphmatch.h"
+
+#include <cstdint>
+
+// Bit-packed prefilter in front of an exact SQDIFF. The lettering is black on
+// white, so a pixel only costs a lot when one side is clearly ink and the other
+// clearly paper. Such an "opposed" pixel pair differs by at least kMinContrast,
+// so
+//
+//   SQDIFF(p) >= opposed(p) * kMinContrast^2
+//
+// and any position with more than kMaxOpposed opposed pixels can't score below
+// kCharMatchThresh. Ink and paper masks of the comic and of every template are
+// packed 64 pixels to a word, so counting opposed pixels is an AND, an OR and a
+// popcount per word of template row. Only the few positions that survive pay
+// for the exact per-pixel SQDIFF, which means the accepted matches and their
+// scores are the same as with the other engines.
+//
+// Baseline x86-64 has no POPCNT instruction, so there __builtin_popcountll is
+// a dozen shifts and masks. The scan is compiled a second time for CPUs with
+// POPCNT and AVX2, where it is one instruction and the SQDIFF loop is
+// vectorized, and which to run is picked when the CPU is known.
+
+struct GlyphBitmaps {
+  struct Bitmap {
+    int words;  // per row
+    std::vector<uint64_t> ink;
+    std::vector<uint64_t> paper;
+  };
+
+  std::vector<Bitmap> bitmaps;
+};
+
+namespace {
+
+const uint8_t kInk = 64;     // Darker than this is certainly ink
+const uint8_t kPaper = 192;  // At least this light is certainly paper
+const int kMinContrast = kPaper - (kInk - 1);
+const int kMaxOpposed =
+    static_cast<int>(kCharMatchThresh / (kMinContrast * kMinContrast));
+
+int wordsFor(int pixels) { return (pixels + 63) / 64; }
+
+// Packs each row of img into `words` words per row, bit x of a row being
+// pixel x
+void packMasks(const cv::Mat& img, int words, std::vector<uint64_t>& ink,
+               std::vector<uint64_t>& paper) {
+  ink.assign(size_t(img.rows) * words, 0);
+  paper.assign(size_t(img.rows) * words, 0);
+  for (int y = 0; y < img.rows; y++) {
+    auto row = img.ptr<uint8_t>(y);
+    auto inkRow = &ink[size_t(y) * words];
+    auto paperRow = &paper[size_t(y) * words];
+    for (int x = 0; x < img.cols; x++) {
+      const auto bit = uint64_t{1} << (x % 64);
+      if (row[x] < kInk) {
+        inkRow[x / 64] |= bit;
+      } else if (row[x] >= kPaper) {
+        paperRow[x / 64] |= bit;
+      }
+    }
+  }
+}
+
+// Everything the scan calls is inlined into it, so that each build of it gets
+// its own code for them
+#define SCAN_INLINE inline __attribute__((always_inline))
+
+struct PackedRegion {
+  int words;  // per row
+  std::vector<uint64_t> ink;
+  std::vector<uint64_t> paper;
+};
+
+// The 64 pixels of a packed row starting at pixel x. The row must have a word
+// to spare past x / 64.
+SCAN_INLINE uint64_t window(const uint64_t* row, int x) {
+  const auto word = x / 64;
+  const auto shift = x % 64;
+  if (shift == 0) {
+    return row[word];
+  }
+  return (row[word] >> shift) | (row[word + 1] << (64 - shift));
+}
+
+SCAN_INLINE bool couldMatch(const GlyphBitmaps::Bitmap& bitmap,
+                            const PackedRegion& packed, int x, int y) {
+  const auto rows = static_cast<int>(bitmap.ink.size()) / bitmap.words;
+  auto opposed = 0;
+  for (int ty = 0; ty < rows; ty++) {
+    auto inkRow = &packed.ink[size_t(y + ty) * packed.words];
+    auto paperRow = &packed.paper[size_t(y + ty) * packed.words];
+    auto tmplInk = &bitmap.ink[size_t(ty) * bitmap.words];
+    auto tmplPaper = &bitmap.paper[size_t(ty) * bitmap.words];
+    for (int w = 0; w < bitmap.words; w++) {
+      // Bits past the end of the template are clear in both of its masks,
+      // so the rest of the window drops out here
+      auto diff = (window(inkRow, x + 64 * w) & tmplPaper[w]) |
+                  (window(paperRow, x + 64 * w) & tmplInk[w]);
+      opposed += __builtin_popcountll(diff);
+    }
+    if (opposed > kMaxOpposed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+SCAN_INLINE float sqdiff(const cv::Mat& regionImg, const cv::Mat& tmplImg,
+                         int x, int y) {
+  int64_t sum = 0;
+  for (int ty = 0; ty < tmplImg.rows; ty++) {
+    auto a = regionImg.ptr<uint8_t>(y + ty) + x;
+    auto t = tmplImg.ptr<uint8_t>(ty);
+    for (int tx = 0; tx < tmplImg.cols; tx++) {
+      const int d = a[tx] - t[tx];
+      sum += d * d;
+    }
+  }
+  return static_cast<float>(sum);
+}
+
+SCAN_INLINE void scan(const GlyphBitmaps::Bitmap& bitmap,
+                      const PackedRegion& packed, const cv::Mat& regionImg,
+                      const cv::Mat& tmplImg, cv::Mat& atlas) {
+  for (int y = 0; y < atlas.rows; y++) {
+    auto out = atlas.ptr<float>(y);
+    for (int x = 0; x < atlas.cols; x++) {
+      out[x] = couldMatch(bitmap, packed, x, y)
+                   ? sqdiff(regionImg, tmplImg, x, y)
+                   : FLT_MAX;
+    }
+  }
+}
+
+void scanPortable(const GlyphBitmaps::Bitmap& bitmap,
+                  const PackedRegion& packed, const cv::Mat& regionImg,
+                  const cv::Mat& tmplImg, cv::Mat& atlas) {
+  scan(bitmap, packed, regionImg, tmplImg, atlas);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("popcnt,avx2"))) void scanPopcntAvx2(
+    const GlyphBitmaps::Bitmap& bitmap, const PackedRegion& packed,
+    const cv::Mat& regionImg, const cv::Mat& tmplImg, cv::Mat& atlas) {
+  scan(bitmap, packed, regionImg, tmplImg, atlas);
+}
+
+bool cpuHasPopcntAvx2() {
+  static const bool has =
+      __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("avx2");
+  return has;
+}
+#else
+bool cpuHasPopcntAvx2() { return false; }
+
+void scanPopcntAvx2(const GlyphBitmaps::Bitmap& bitmap,
+                    const PackedRegion& packed, const cv::Mat& regionImg,
+                    const cv::Mat& tmplImg, cv::Mat& atlas) {
+  scanPortable(bitmap, packed, regionImg, tmplImg, atlas);
+}
+#endif
+
+const GlyphBitmaps& glyphBitmaps(const Models& models) {
+  return models.glyphBitmaps.get([&] {
+    auto result = std::make_shared<GlyphBitmaps>();
+    for (const auto& tmpl : models.glyphs) {
+      auto bitmap = GlyphBitmaps::Bitmap{};
+      bitmap.words = wordsFor(tmpl.img.cols);
+      packMasks(tmpl.img, bitmap.words, bitmap.ink, bitmap.paper);
+      result->bitmaps.push_back(std::move(bitmap));
+    }
+    return std::shared_ptr<const GlyphBitmaps>{result};
+  });
+}
+
+class BinaryGlyphMatcher : public GlyphMatcher {
+ public:
+  BinaryGlyphMatcher(const cv::Mat& img_,
+                     const std::vector<cv::Rect>& regions_,
+                     const Models& models, bool allowSimd)
+      : img{img_},
+        regions{regions_},
+        templates{models.glyphs},
+        glyphs{glyphBitmaps(models)},
+        simd{allowSimd && cpuHasPopcntAvx2()} {
+    for (const auto& region : regions) {
+      auto packed = PackedRegion{};
+      // One spare word so window() never reads past the end of a row
+      packed.words = wordsFor(region.width) + 1;
+      packMasks(cv::Mat{img, region}, packed.words, packed.ink, packed.paper);
+      packedRegions.push_back(std::move(packed));
+    }
+  }
+
+  cv::Mat match(size_t tmpl, size_t region) const override {
+    const auto& tmplImg = templates[tmpl].img;
+    const auto& bitmap = glyphs.bitmaps[tmpl];
+    const auto& packed = packedRegions[region];
+    const auto regionImg = cv::Mat{img, regions[region]};
+
+    auto atlas = cv::Mat{regionImg.rows - tmplImg.rows + 1,
+                         regionImg.cols - tmplImg.cols + 1, CV_32F};
+
+    if (simd) {
+      scanPopcntAvx2(bitmap, packed, regionImg, tmplImg, atlas);
+    } else {
+      scanPortable(bitmap, packed, regionImg, tmplImg, atlas);
+    }
+    return atlas;
+  }
+
+ private:
+  cv::Mat img;
+  std::vector<cv::Rect> regions;
+  const std::vector<Template>& templates;
+  const GlyphBitmaps& glyphs;
+  std::vector<PackedRegion> packedRegions;
+  bool simd;
+};
+
+}  // namespace
+
+bool binaryGlyphMatcherHasSimd() { return cpuHasPopcntAvx2(); }
+
+std::unique_ptr<GlyphMatcher> makeBinaryGlyphMatcher(
+    const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models, bool allowSimd) {
+  return std::unique_ptr<GlyphMatcher>{
+      new BinaryGlyphMatcher{img, regions, models, allowSimd}};
+}
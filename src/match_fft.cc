@@ -0,0 +1,169 @@
+#include "glyphmatch.h"
+
+// FFT based SQDIFF matching. For a template T at position p,
+//
+//   SQDIFF(p) = sum(I^2 under T at p) - 2 * corr(I, T)(p) + sum(T^2)
+//
+// The first term comes from an integral image of I^2, the last is a constant
+// per template, and the correlation is a pointwise product in the frequency
+// domain. The comic is cut into fixed size overlapping tiles that are
+// transformed once, so each template only costs a multiply and an inverse
+// transform per tile. Since the tile size never changes, template spectra are
+// computed once per run and kept with the models.
+
+struct GlyphSpectra {
+  static const int kTileSize = 128;
+
+  std::vector<cv::Mat> spectra;  // empty for templates that don't fit a tile
+  std::vector<double> energy;    // sum(T^2)
+  cv::Size maxTemplate;          // largest template that does fit
+};
+
+namespace {
+
+const GlyphSpectra& glyphSpectra(const Models& models) {
+  return models.glyphSpectra.get([&] {
+    const auto kTileSize = GlyphSpectra::kTileSize;
+    auto result = std::make_shared<GlyphSpectra>();
+    result->maxTemplate = cv::Size{1, 1};
+
+    for (const auto& tmpl : models.glyphs) {
+      auto spectrum = cv::Mat{};
+      auto energy = 0.0;
+
+      // Only templates up to half a tile get the FFT treatment, otherwise a
+      // tile would yield hardly any positions
+      if (tmpl.img.cols <= kTileSize / 2 && tmpl.img.rows <= kTileSize / 2) {
+        auto padded = cv::Mat{kTileSize, kTileSize, CV_32F, cv::Scalar{0}};
+        auto roi = cv::Mat{padded, cv::Rect{{0, 0}, tmpl.img.size()}};
+        tmpl.img.convertTo(roi, CV_32F);
+        cv::dft(padded, spectrum);
+
+        for (int y = 0; y < roi.rows; y++) {
+          for (int x = 0; x < roi.cols; x++) {
+            energy += roi.at<float>(y, x) * roi.at<float>(y, x);
+          }
+        }
+
+        result->maxTemplate.width =
+            std::max(result->maxTemplate.width, tmpl.img.cols);
+        result->maxTemplate.height =
+            std::max(result->maxTemplate.height, tmpl.img.rows);
+      }
+
+      result->spectra.push_back(spectrum);
+      result->energy.push_back(energy);
+    }
+
+    return std::shared_ptr<const GlyphSpectra>{result};
+  });
+}
+
+class FftGlyphMatcher : public GlyphMatcher {
+ public:
+  FftGlyphMatcher(const cv::Mat& img_, const std::vector<cv::Rect>& regions_,
+                  const Models& models)
+      : img{img_},
+        regions{regions_},
+        templates{models.glyphs},
+        glyphs{glyphSpectra(models)} {
+    const auto kTileSize = GlyphSpectra::kTileSize;
+
+    // Consecutive tiles overlap by the largest template so that every
+    // position is fully inside some tile for every template
+    step = cv::Size{kTileSize - glyphs.maxTemplate.width + 1,
+                    kTileSize - glyphs.maxTemplate.height + 1};
+
+    for (const auto& region : regions) {
+      auto regionImg = cv::Mat{img, region};
+
+      auto sum = cv::Mat{};
+      auto sqsum = cv::Mat{};
+      cv::integral(regionImg, sum, sqsum, CV_64F);
+      sqsums.push_back(sqsum);
+
+      std::vector<Tile> regionTiles;
+      for (int y = 0; y < region.height; y += step.height) {
+        for (int x = 0; x < region.width; x += step.width) {
+          auto tile = Tile{};
+          tile.origin = cv::Point{x, y};
+
+          auto padded = cv::Mat{kTileSize, kTileSize, CV_32F, cv::Scalar{0}};
+          auto size = cv::Size{std::min(kTileSize, region.width - x),
+                               std::min(kTileSize, region.height - y)};
+          auto dst = cv::Mat{padded, cv::Rect{{0, 0}, size}};
+          cv::Mat{regionImg, cv::Rect{tile.origin, size}}.convertTo(dst,
+                                                                     CV_32F);
+          cv::dft(padded, tile.spectrum);
+
+          regionTiles.push_back(tile);
+        }
+      }
+      tiles.push_back(regionTiles);
+    }
+  }
+
+  cv::Mat match(size_t tmpl, size_t region) const override {
+    const auto& tmplImg = templates[tmpl].img;
+    const auto& bounds = regions[region];
+
+    if (glyphs.spectra[tmpl].empty()) {
+      auto atlas = cv::Mat{};
+      cv::matchTemplate(cv::Mat{img, bounds}, tmplImg, atlas, CV_TM_SQDIFF);
+      return atlas;
+    }
+
+    auto atlas = cv::Mat{bounds.height - tmplImg.rows + 1,
+                         bounds.width - tmplImg.cols + 1, CV_32F};
+    const auto& sqsum = sqsums[region];
+    const auto energy = glyphs.energy[tmpl];
+
+    auto product = cv::Mat{};
+    auto corr = cv::Mat{};
+    for (const auto& tile : tiles[region]) {
+      cv::mulSpectrums(tile.spectrum, glyphs.spectra[tmpl], product, 0, true);
+      cv::dft(product, corr,
+              cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+      auto width = std::min(step.width, atlas.cols - tile.origin.x);
+      auto height = std::min(step.height, atlas.rows - tile.origin.y);
+      for (int y = 0; y < height; y++) {
+        auto ay = tile.origin.y + y;
+        auto out = atlas.ptr<float>(ay) + tile.origin.x;
+        auto top = sqsum.ptr<double>(ay) + tile.origin.x;
+        auto bottom = sqsum.ptr<double>(ay + tmplImg.rows) + tile.origin.x;
+        auto c = corr.ptr<float>(y);
+        for (int x = 0; x < width; x++) {
+          auto windowEnergy = bottom[x + tmplImg.cols] - bottom[x] -
+                              top[x + tmplImg.cols] + top[x];
+          out[x] = std::max(0.0, windowEnergy - 2.0 * c[x] + energy);
+        }
+      }
+    }
+
+    return atlas;
+  }
+
+ private:
+  struct Tile {
+    cv::Point origin;  // relative to the region
+    cv::Mat spectrum;
+  };
+
+  cv::Mat img;
+  std::vector<cv::Rect> regions;
+  const std::vector<Template>& templates;
+  const GlyphSpectra& glyphs;
+  cv::Size step;
+  std::vector<cv::Mat> sqsums;             // per region
+  std::vector<std::vector<Tile>> tiles;    // per region
+};
+
+}  // namespace
+
+std::unique_ptr<GlyphMatcher> makeFftGlyphMatcher(
+    const cv::Mat& img, const std::vector<cv::Rect>& regions,
+    const Models& models) {
+  return std::unique_ptr<GlyphMatcher>{
+      new FftGlyphMatcher{img, regions, models}};
+}
@@ -0,0 +1,271 @@
+#include "context.h"
+
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+// A model bundle is everything loadModels() would otherwise have to decode and
+// compute, laid out so it can be used straight out of an mmap:
+//
+//   BundleHeader
+//   glyphCount x { RecordHeader, label, pixels }
+//   actorCount x { RecordHeader, name, pixels, keypoints, descriptors }
+//   DictionaryHeader, slots, text
+//
+// Every field starts on a kAlign boundary. Labels are already resolved (no
+// "dot"/"slash" file names), both orientations of each actor are stored
+// with their SIFT features and the word list is a ready to use Dictionary.
+namespace {
+
+const char kBundleMagic[8] = {'J', 'C', 'M', 'O', 'D', 'E', 'L', '\0'};
+const uint32_t kBundleVersion = 2;
+const size_t kAlign = 16;
+
+struct BundleHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t glyphCount;
+  uint32_t actorCount;
+  uint32_t reserved;
+};
+
+struct RecordHeader {
+  uint32_t nameLength;
+  uint32_t rows;
+  uint32_t cols;
+  uint32_t keypointCount;
+  uint32_t descriptorRows;
+  uint32_t descriptorCols;
+  int32_t descriptorType;
+  uint32_t reserved;
+};
+
+struct DictionaryHeader {
+  uint32_t slotCount;
+  uint32_t textSize;
+};
+
+struct PackedKeyPoint {
+  float x, y, size, angle, response;
+  int32_t octave, classId;
+};
+
+size_t aligned(size_t n) { return (n + kAlign - 1) / kAlign * kAlign; }
+
+class BundleWriter {
+ public:
+  BundleWriter(const std::string& path) : out{path, std::ios::binary} {
+    if (!out) {
+      throw std::runtime_error{"Couldn't write bundle: " + path};
+    }
+  }
+
+  void write(const void* data, size_t size) {
+    out.write(reinterpret_cast<const char*>(data), size);
+    const char zeros[kAlign] = {};
+    out.write(zeros, aligned(size) - size);
+  }
+
+  void writeMat(const cv::Mat& mat) {
+    auto continuous = mat.isContinuous() ? mat : mat.clone();
+    write(continuous.data, continuous.total() * continuous.elemSize());
+  }
+
+ private:
+  std::ofstream out;
+};
+
+class BundleReader {
+ public:
+  BundleReader(const uint8_t* begin_, const uint8_t* end_)
+      : pos{begin_}, end{end_} {}
+
+  const uint8_t* read(size_t size) {
+    ASSERT(pos + size <= end, ": model bundle is truncated");
+    auto result = pos;
+    pos += aligned(size);
+    return result;
+  }
+
+  template <class T>
+  const T& read() {
+    return *reinterpret_cast<const T*>(read(sizeof(T)));
+  }
+
+  // Wraps the mapped bytes, no copy
+  cv::Mat readMat(int rows, int cols, int type) {
+    auto data = read(size_t(rows) * cols * CV_ELEM_SIZE(type));
+    return cv::Mat{rows, cols, type, const_cast<uint8_t*>(data)};
+  }
+
+ private:
+  const uint8_t* pos;
+  const uint8_t* end;
+};
+
+}  // namespace
+
+void writeBundle(const std::string& path,
+                 const std::vector<Template>& glyphs,
+                 const std::vector<ActorTemplate>& actors,
+                 const Dictionary& words) {
+  auto writer = BundleWriter{path};
+
+  auto header = BundleHeader{};
+  std::copy(std::begin(kBundleMagic), std::end(kBundleMagic), header.magic);
+  header.version = kBundleVersion;
+  header.glyphCount = glyphs.size();
+  header.actorCount = actors.size();
+  writer.write(&header, sizeof(header));
+
+  for (const auto& glyph : glyphs) {
+    ASSERT(glyph.img.type() == CV_8U);
+    auto record = RecordHeader{};
+    record.nameLength = glyph.name.size();
+    record.rows = glyph.img.rows;
+    record.cols = glyph.img.cols;
+    writer.write(&record, sizeof(record));
+    writer.write(glyph.name.data(), glyph.name.size());
+    writer.writeMat(glyph.img);
+  }
+
+  for (const auto& actor : actors) {
+    ASSERT(actor.img.type() == CV_8U);
+    auto record = RecordHeader{};
+    record.nameLength = actor.name.size();
+    record.rows = actor.img.rows;
+    record.cols = actor.img.cols;
+    record.keypointCount = actor.keypoints.size();
+    record.descriptorRows = actor.descriptors.rows;
+    record.descriptorCols = actor.descriptors.cols;
+    record.descriptorType = actor.descriptors.type();
+    writer.write(&record, sizeof(record));
+    writer.write(actor.name.data(), actor.name.size());
+    writer.writeMat(actor.img);
+
+    std::vector<PackedKeyPoint> keypoints;
+    for (const auto& kp : actor.keypoints) {
+      keypoints.push_back({kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response,
+                           kp.octave, kp.class_id});
+    }
+    writer.write(keypoints.data(), keypoints.size() * sizeof(PackedKeyPoint));
+    writer.writeMat(actor.descriptors);
+  }
+
+  auto dictionary = DictionaryHeader{};
+  dictionary.slotCount = words.slotCount();
+  dictionary.textSize = words.textSize();
+  writer.write(&dictionary, sizeof(dictionary));
+  writer.write(words.slotData(), words.slotCount() * sizeof(uint32_t));
+  writer.write(words.textData(), words.textSize());
+}
+
+void loadBundle(const std::string& path, Models& models) {
+  auto fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    throw std::runtime_error{"Couldn't open bundle: " + path};
+  }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error{"Couldn't stat bundle: " + path};
+  }
+  auto size = static_cast<size_t>(st.st_size);
+  auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error{"Couldn't map bundle: " + path};
+  }
+  // The templates point straight into the mapping, so it lives as long as the
+  // models do
+  models.storage = std::shared_ptr<const void>{
+      mapping, [size](const void* p) { munmap(const_cast<void*>(p), size); }};
+
+  auto begin = static_cast<const uint8_t*>(mapping);
+  auto reader = BundleReader{begin, begin + size};
+
+  const auto& header = reader.read<BundleHeader>();
+  if (!std::equal(std::begin(kBundleMagic), std::end(kBundleMagic),
+                  header.magic)) {
+    throw std::runtime_error{path + " is not a model bundle"};
+  }
+  if (header.version != kBundleVersion) {
+    throw std::runtime_error{path + " is bundle version " +
+                             std::to_string(header.version) + ", expected " +
+                             std::to_string(kBundleVersion) +
+                             " (rerun jerkcity-pack)"};
+  }
+
+  models.glyphs.clear();
+  for (uint32_t i = 0; i < header.glyphCount; i++) {
+    const auto& record = reader.read<RecordHeader>();
+    auto name = reinterpret_cast<const char*>(reader.read(record.nameLength));
+    auto img = reader.readMat(record.rows, record.cols, CV_8U);
+    models.glyphs.emplace_back(std::string{name, record.nameLength}, img);
+  }
+
+  models.actors.clear();
+  for (uint32_t i = 0; i < header.actorCount; i++) {
+    const auto& record = reader.read<RecordHeader>();
+    auto name = reinterpret_cast<const char*>(reader.read(record.nameLength));
+    auto img = reader.readMat(record.rows, record.cols, CV_8U);
+
+    auto packed = reinterpret_cast<const PackedKeyPoint*>(
+        reader.read(record.keypointCount * sizeof(PackedKeyPoint)));
+    std::vector<cv::KeyPoint> keypoints;
+    keypoints.reserve(record.keypointCount);
+    for (uint32_t k = 0; k < record.keypointCount; k++) {
+      const auto& kp = packed[k];
+      keypoints.emplace_back(kp.x, kp.y, kp.size, kp.angle, kp.response,
+                             kp.octave, kp.classId);
+    }
+
+    auto descriptors = reader.readMat(
+        record.descriptorRows, record.descriptorCols, record.descriptorType);
+
+    models.actors.emplace_back(std::string{name, record.nameLength}, img,
+                               std::move(keypoints), descriptors);
+  }
+
+  const auto& dictionary = reader.read<DictionaryHeader>();
+  auto slots = reinterpret_cast<const uint32_t*>(
+      reader.read(dictionary.slotCount * sizeof(uint32_t)));
+  auto text = reinterpret_cast<const char*>(reader.read(dictionary.textSize));
+  models.words =
+      Dictionary{slots, dictionary.slotCount, text, dictionary.textSize};
+}
+
+// Where the bundle built alongside the binary lives, so that jerkcity can be
+// run from any directory
+std::string defaultBundlePath() {
+  char exe[4096];
+  auto length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (length <= 0) {
+    return "";
+  }
+  exe[length] = '\0';
+  return (fs::path{exe}.parent_path() / "jerkcity.bundle").string();
+}
+
+Models loadModels(const std::string& bundlePath) {
+  auto models = Models{};
+
+  auto path = bundlePath != "" ? bundlePath : defaultBundlePath();
+  if (bundlePath != "" || (path != "" && fs::exists(path))) {
+    loadBundle(path, models);
+  } else {
+    // No bundle, do it the slow way (relative to the working directory)
+    models.glyphs = loadTemplates("glyphs");
+    models.actors = loadActors("actors");
+    models.words = Dictionary{loadWords(kWordsPath)};
+  }
+
+  return models;
+}
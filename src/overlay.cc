@@ -0,0 +1,174 @@
+#include "overlay.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+#include <opencv2/highgui/highgui.hpp>
+
+#include "gif.h"
+
+namespace {
+
+// In DebugStage order
+const char* const kStageNames[] = {"panels", "textRegions", "glyphs",
+                                   "words",  "lines",       "bubbles",
+                                   "garbageLines"};
+
+cv::Mat loadColour(const std::string& inFile, const std::vector<uchar>& encoded) {
+  auto img = cv::Mat{};
+  auto grey = cv::Mat{};
+  if (inFile == "") {
+    if (isGif(encoded)) {
+      decodeGif(encoded, grey, &img);
+    } else {
+      img = cv::imdecode(encoded, CV_LOAD_IMAGE_COLOR);
+    }
+  } else if (isGifFile(inFile)) {
+    std::ifstream in{inFile, std::ios::binary};
+    const auto data = std::vector<uchar>(std::istreambuf_iterator<char>{in},
+                                         std::istreambuf_iterator<char>{});
+    decodeGif(data, grey, &img);
+  } else {
+    img = cv::imread(inFile, CV_LOAD_IMAGE_COLOR);
+  }
+  if (img.dims == 0) {
+    throw std::runtime_error{"Couldn't load debug image"};
+  }
+  return img;
+}
+
+}  // namespace
+
+DebugStages parseDebugStages(const std::string& names) {
+  if (names == "all") {
+    return kAllDebugStages;
+  }
+  auto stages = DebugStages{0};
+  auto in = std::istringstream{names};
+  auto name = std::string{};
+  while (std::getline(in, name, ',')) {
+    auto found = false;
+    for (size_t i = 0; i < sizeof(kStageNames) / sizeof(kStageNames[0]); i++) {
+      if (name == kStageNames[i]) {
+        stages |= 1u << i;
+        found = true;
+      }
+    }
+    if (!found) {
+      throw std::runtime_error{"Unknown debug stage: " + name};
+    }
+  }
+  return stages;
+}
+
+void DebugOverlay::line(DebugStage stage, cv::Point a, cv::Point b,
+                        cv::Scalar colour, int thickness, int lineType) {
+  add(stage, true, a.x, a.y, b.x, b.y, colour, thickness, lineType);
+}
+
+void DebugOverlay::rect(DebugStage stage, cv::Rect bounds, cv::Scalar colour,
+                        int thickness) {
+  add(stage, false, bounds.x, bounds.y, bounds.width, bounds.height, colour,
+      thickness, 8);
+}
+
+void DebugOverlay::add(DebugStage stage, bool isLine, int x0, int y0, int x1,
+                       int y1, cv::Scalar colour, int thickness,
+                       int lineType) {
+  auto shape = Shape{};
+  shape.x0 = x0;
+  shape.y0 = y0;
+  shape.x1 = x1;
+  shape.y1 = y1;
+  for (auto i = 0; i < 3; i++) {
+    shape.bgr[i] = cv::saturate_cast<uchar>(colour[i]);
+  }
+  shape.thickness = static_cast<int8_t>(thickness);
+  shape.lineType = static_cast<uint8_t>(lineType);
+  shape.stage = stage;
+  shape.isLine = isLine;
+  shapes.push_back(shape);
+}
+
+void DebugOverlay::render(cv::Mat& img, DebugStages stages) const {
+  for (const auto& shape : shapes) {
+    if (!(stages & (1u << static_cast<unsigned>(shape.stage)))) {
+      continue;
+    }
+    const auto colour = cv::Scalar{static_cast<double>(shape.bgr[0]),
+                                   static_cast<double>(shape.bgr[1]),
+                                   static_cast<double>(shape.bgr[2])};
+    if (shape.isLine) {
+      cv::line(img, {shape.x0, shape.y0}, {shape.x1, shape.y1}, colour,
+               shape.thickness, shape.lineType);
+    } else {
+      cv::rectangle(img, cv::Rect{shape.x0, shape.y0, shape.x1, shape.y1},
+                    colour, shape.thickness);
+    }
+  }
+}
+
+const size_t DebugWriter::kDefaultMaxQueued;
+
+DebugWriter::DebugWriter(DebugStages stages_, size_t maxQueued_)
+    : stages{stages_},
+      maxQueued{std::max<size_t>(1, maxQueued_)},
+      thread{[this] { writerLoop(); }} {}
+
+DebugWriter::~DebugWriter() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  thread.join();
+}
+
+void DebugWriter::write(const std::string& inFile, DebugOverlay overlay,
+                        const std::string& outFile) {
+  push(Job{inFile, {}, std::move(overlay), outFile});
+}
+
+void DebugWriter::write(std::vector<uchar> encoded, DebugOverlay overlay,
+                        const std::string& outFile) {
+  push(Job{"", std::move(encoded), std::move(overlay), outFile});
+}
+
+void DebugWriter::push(Job job) {
+  {
+    std::unique_lock<std::mutex> lock{mutex};
+    room.wait(lock, [&] { return jobs.size() < maxQueued; });
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+void DebugWriter::writerLoop() {
+  while (true) {
+    auto job = Job{};
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      wake.wait(lock, [&] { return stopping || !jobs.empty(); });
+      if (jobs.empty()) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    room.notify_one();
+
+    try {
+      auto img = loadColour(job.inFile, job.encoded);
+      job.overlay.render(img, stages);
+      if (!cv::imwrite(job.outFile, img)) {
+        throw std::runtime_error{"Couldn't write"};
+      }
+    }
+    catch (const std::exception& e) {
+      std::cerr << job.outFile << ": " << e.what() << "\n";
+    }
+  }
+}
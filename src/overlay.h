@@ -0,0 +1,108 @@
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+// The stage that drew something on the debug image, so that only the stages of
+// interest need be rendered
+enum class DebugStage : uint8_t {
+  Panels,
+  TextRegions,
+  Glyphs,
+  Words,
+  Lines,
+  Bubbles,
+  GarbageLines,
+};
+
+// A set of DebugStages, one bit each
+using DebugStages = unsigned;
+const DebugStages kAllDebugStages = ~0u;
+
+// A comma separated list of stage names (panels, textRegions, glyphs, words,
+// lines, bubbles, garbageLines) or "all"
+DebugStages parseDebugStages(const std::string& names);
+
+// The debug drawing done while processing a comic, kept as a list of shapes
+// rather than drawn, so that recording one is an append. render() draws them,
+// in the order they were recorded, over the comic in colour.
+class DebugOverlay {
+ public:
+  void line(DebugStage stage, cv::Point a, cv::Point b, cv::Scalar colour,
+            int thickness, int lineType = 8);
+  // A negative thickness (CV_FILLED) fills the rectangle
+  void rect(DebugStage stage, cv::Rect bounds, cv::Scalar colour,
+            int thickness);
+
+  void render(cv::Mat& img, DebugStages stages) const;
+  bool empty() const { return shapes.empty(); }
+
+ private:
+  struct Shape {
+    int x0, y0, x1, y1;  // a line's ends, or a rect's x, y, w, h
+    uchar bgr[3];
+    int8_t thickness;
+    uint8_t lineType;
+    DebugStage stage;
+    bool isLine;
+  };
+
+  void add(DebugStage stage, bool isLine, int x0, int y0, int x1, int y1,
+           cv::Scalar colour, int thickness, int lineType);
+
+  std::vector<Shape> shapes;
+};
+
+// Renders overlays onto their comics and writes them out as PNGs on a thread of
+// its own, so none of the decoding, drawing or encoding holds up
+// transcription. At most `maxQueued` wait to be written; past that write()
+// blocks until there is room, so workers that transcribe faster than PNGs can
+// be encoded are slowed down rather than piling up comics in memory. Whatever
+// is queued is written before the destructor returns.
+class DebugWriter {
+ public:
+  static const size_t kDefaultMaxQueued = 16;
+
+  explicit DebugWriter(DebugStages stages_,
+                       size_t maxQueued_ = kDefaultMaxQueued);
+  ~DebugWriter();
+
+  DebugWriter(const DebugWriter&) = delete;
+  DebugWriter& operator=(const DebugWriter&) = delete;
+
+  // The comic is read again from `inFile`, or decoded from `encoded`
+  void write(const std::string& inFile, DebugOverlay overlay,
+             const std::string& outFile);
+  void write(std::vector<uchar> encoded, DebugOverlay overlay,
+             const std::string& outFile);
+
+ private:
+  struct Job {
+    std::string inFile;
+    std::vector<uchar> encoded;
+    DebugOverlay overlay;
+    std::string outFile;
+  };
+
+  void push(Job job);
+  void writerLoop();
+
+  const DebugStages stages;
+  const size_t maxQueued;
+  std::mutex mutex;
+  std::condition_variable wake;  // a job was queued, or stopping
+  std::condition_variable room;  // a job was taken off the queue
+  std::deque<Job> jobs;
+  bool stopping = false;
+  std::thread thread;  // last, so it starts once the rest is set up
+};
+
+#endif
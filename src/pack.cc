@@ -0,0 +1,41 @@
+#include "context.h"
+
+#include <iostream>
+
+#include <boost/program_options.hpp>
+
+// Compiles the glyph and actor template directories and the word list into a
+// model bundle that jerkcity can mmap at startup instead of decoding PNGs,
+// running SIFT and parsing the word list.
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = po::options_description{"Allowed options"};
+  desc.add_options()("help", "this message")(
+      "glyphs", po::value<std::string>()->default_value("glyphs"),
+      "directory of glyph templates")(
+      "actors", po::value<std::string>()->default_value("actors"),
+      "directory of actor templates")(
+      "words", po::value<std::string>()->default_value(kWordsPath),
+      "word list, one per line")(
+      "output", po::value<std::string>()->default_value("jerkcity.bundle"),
+      "bundle to write");
+
+  auto vm = po::variables_map{};
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return -1;
+  }
+
+  auto glyphs = loadTemplates(vm["glyphs"].as<std::string>());
+  auto actors = loadActors(vm["actors"].as<std::string>());
+  auto words = loadWords(vm["words"].as<std::string>());
+  writeBundle(vm["output"].as<std::string>(), glyphs, actors,
+              Dictionary{words});
+
+  std::cout << "Packed " << glyphs.size() << " glyphs, " << actors.size()
+            << " actor templates and " << words.size() << " words into "
+            << vm["output"].as<std::string>() << "\n";
+}
@@ -2,18 +2,51 @@
 
 void drawDebugLine(Context& ctx, int x0, int y0, int x1, int y1) {
   if (ctx.debug) {
-    cv::line(ctx.debugImg, {x0, y0}, {x1, y1}, {0, 0, 255}, 3);
+    ctx.overlay.line(DebugStage::Panels, {x0, y0}, {x1, y1}, {0, 0, 255}, 3);
   }
 }
 
+namespace {
+
+const uint8_t kBasicallyWhite =
+    200;  // Any value above this is to be considered "white"
+const uint8_t kBasicallllllllyWhite = 127;
+
+// The first x in [from, to) with row[x] < threshold, or `to`. Whole blocks are
+// ruled out by their darkest pixel, which vectorizes where a pixel by pixel
+// search can't.
+size_t firstBelow(const uint8_t* row, size_t from, size_t to,
+                  uint8_t threshold) {
+  const size_t kBlock = 32;
+  auto x = from;
+  for (; x + kBlock <= to; x += kBlock) {
+    uint8_t darkest = 255;
+    for (size_t i = 0; i < kBlock; i++) {
+      darkest = std::min(darkest, row[x + i]);
+    }
+    if (darkest < threshold) {
+      break;
+    }
+  }
+  for (; x < to && row[x] >= threshold; x++) {
+  }
+  return x;
+}
+
+}  // namespace
+
+// The divider search below only ever asks how far a row or column stays white,
+// so that is worked out for every row and column up front. Rows are read in
+// order, and the top of the comic (where columns need more than their first
+// non-white pixel) is transposed so that its columns are contiguous too.
 void findPanels(Context& ctx) {
   ASSERT(ctx.img.channels() == 1);
 
   const size_t kSkipAmount =
       50;  // If we find a panel divider, skip 80 pixels for the next one.
-  const uint8_t kBasicallyWhite =
-      200;  // Any value above this is to be considered "white"
-  const uint8_t kBasicallllllllyWhite = 127;
+  const size_t kPointOfNoReturn = 250;
+  const size_t kUrgTolerance = 7;
+  const size_t kYFloor = 3;  // Some comics have a bar across the top
 
   const size_t width = ctx.img.size().width;
   const size_t height = ctx.img.size().height;
@@ -23,18 +56,52 @@ void findPanels(Context& ctx) {
         "Image is too small for these algorithms to work..."};
   }
 
-  auto* data = (uint8_t*)ctx.img.data;
+  // Columns may tunnel through non-white pixels above the point of no return,
+  // so only below it is their first non-white pixel all that matters
+  const size_t bandEnd = std::min(height, kPointOfNoReturn + 1);
 
-  // Find horizontal lines
-  std::vector<size_t> ys;
+  // Per row, the first x (from 1) below each threshold. Per column, the first
+  // y at or past bandEnd below kBasicallyWhite.
+  std::vector<size_t> firstDarkX(height);
+  std::vector<size_t> firstGreyX(height);
+  std::vector<size_t> firstGreyYBelowBand(width, height);
+  auto columnsLeft = bandEnd < height;
   for (size_t y = 0; y < height; y++) {
-    size_t x;
+    auto row = ctx.img.ptr<uint8_t>(y);
     // Hack: start at 1 because some comics have a 1px left border
-    for (x = 1; x < width && data[x + y * width] >=
-                                 (ys.size() > 1 ? kBasicallyWhite
-                                                : kBasicallllllllyWhite);
-         x++) {
+    firstGreyX[y] = firstBelow(row, 1, width, kBasicallyWhite);
+    firstDarkX[y] =
+        firstBelow(row, firstGreyX[y], width, kBasicallllllllyWhite);
+
+    if (y >= bandEnd && columnsLeft) {
+      auto greyY = firstGreyYBelowBand.data();
+      for (size_t x = 0; x < width; x++) {
+        greyY[x] = std::min(greyY[x], row[x] < kBasicallyWhite ? y : height);
+      }
+      if (y % 16 == 0) {
+        columnsLeft = std::find(firstGreyYBelowBand.begin(),
+                                firstGreyYBelowBand.end(),
+                                height) != firstGreyYBelowBand.end();
+      }
+    }
+  }
+
+  auto band = cv::Mat{};
+  cv::transpose(cv::Mat{ctx.img, cv::Rect{0, 0, int(width), int(bandEnd)}},
+                band);
+  std::vector<size_t> firstGreyY(width);
+  for (size_t x = 0; x < width; x++) {
+    firstGreyY[x] =
+        firstBelow(band.ptr<uint8_t>(x), kYFloor, bandEnd, kBasicallyWhite);
+    if (firstGreyY[x] == bandEnd) {
+      firstGreyY[x] = firstGreyYBelowBand[x];
     }
+  }
+
+  // Find horizontal lines
+  std::vector<size_t> ys;
+  for (size_t y = 0; y < height; y++) {
+    size_t x = ys.size() > 1 ? firstGreyX[y] : firstDarkX[y];
 
     // Ensure there is a divider above the top panels
     if (ys.size() == 0 && y > kSkipAmount) {
@@ -52,39 +119,55 @@ void findPanels(Context& ctx) {
   }
 
   // Find vertical lines
-  const size_t kPointOfNoReturn = 250;
-  const size_t kUrgTolerance = 7;
-  const size_t kYFloor = 3;  // Some comics have a bar across the top
   size_t urgCounter = 0;
   std::vector<size_t> xs;
   for (size_t x = 0; x < width; x++) {
     size_t y;
-    for (y = kYFloor; y < height; y++) {
-      if (data[x + y * width] < kBasicallyWhite) {
+    if (xs.size() > 1) {
+      // Any non-white pixel stops the line
+      y = firstGreyY[x];
 #ifdef RED_KICKSTARTER_FOOTER
-        // hack: during the BBoJC Kickstarter a red footer was applied to each
-        // comic
-        if (y > height - 30) {
-          y = height;
-          break;
-        }
+      if (y < height && y > height - 30) {
+        y = height;
+      }
+#endif
+    } else {
+      auto column = band.ptr<uint8_t>(x);
+      for (y = kYFloor; y < bandEnd; y++) {
+        if (column[y] < kBasicallyWhite) {
+#ifdef RED_KICKSTARTER_FOOTER
+          // hack: during the BBoJC Kickstarter a red footer was applied to
+          // each comic
+          if (y > height - 30) {
+            y = height;
+            break;
+          }
 #endif
 
-        // After some point we do not permit any non-white pixels
-        if (y > kPointOfNoReturn) {
-          break;
+          // If we are near the top of the image, permit some amount of
+          // non-white chars
+          // This allows the line to "tunnel through" the title text which
+          // sometimes
+          // overflows panel 1.
+          if (urgCounter++ > kUrgTolerance) {
+            break;
+          }
+        } else {
+          urgCounter = 0;
         }
+      }
 
-        // If we are near the top of the image, permit some amount of non-white
-        // chars
-        // This allows the line to "tunnel through" the title text which
-        // sometimes
-        // overflows panel 1.
-        if (xs.size() > 1 || urgCounter++ > kUrgTolerance) {
-          break;
+      // After some point we do not permit any non-white pixels
+      if (y == bandEnd && bandEnd < height) {
+        y = firstGreyYBelowBand[x];
+        if (y != bandEnd) {
+          urgCounter = 0;  // there was a white pixel on the way
         }
-      } else {
-        urgCounter = 0;
+#ifdef RED_KICKSTARTER_FOOTER
+        if (y < height && y > height - 30) {
+          y = height;
+        }
+#endif
       }
     }
 
@@ -123,7 +206,7 @@ void findPanels(Context& ctx) {
   }
 
   if (ctx.debugJson) {
-    std::cerr << "\t\"panels\": [\n";
+    ctx.debugOut << "\t\"panels\": [\n";
   }
 
   // Collect panels, in sorted order
@@ -136,21 +219,24 @@ void findPanels(Context& ctx) {
       ASSERT(x0 < x1 && y0 < y1);
       ctx.panels.emplace_back(Panel{cv::Rect{x0, y0, x1 - x0, y1 - y0}});
       if (ctx.debugJson) {
-        std::cerr << "\t\t{ ";
-        printRectJson(ctx.panels.back().bounds);
-        std::cerr << " },\n";
+        ctx.debugOut << "\t\t{ ";
+        printRectJson(ctx.debugOut, ctx.panels.back().bounds);
+        ctx.debugOut << " },\n";
       }
     }
   }
 
   if (ctx.debugJson) {
-    std::cerr << "\t],\n";
+    ctx.debugOut << "\t],\n";
   }
 
+  // Blank out the starring panel so nothing gets recognized in it. ctx.img is
+  // private to this comic (batch workers each load their own), so scribbling
+  // on it is safe.
   cv::rectangle(ctx.img, ctx.panels[0].bounds, cv::Scalar(0, 255, 0),
                 CV_FILLED);
   if (ctx.debug) {
-    cv::rectangle(ctx.debugImg, ctx.panels[0].bounds, cv::Scalar(0, 255, 0),
-                  CV_FILLED);
+    ctx.overlay.rect(DebugStage::Panels, ctx.panels[0].bounds,
+                     cv::Scalar(0, 255, 0), CV_FILLED);
   }
 }
@@ -0,0 +1,98 @@
+#include "perf.h"
+
+#ifdef __linux__
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+int openCounter(uint64_t config) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+}  // namespace
+
+PerfCounters::PerfCounters() {
+  fds[kCycles] = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+  fds[kInstructions] = openCounter(PERF_COUNT_HW_INSTRUCTIONS);
+  fds[kCacheMisses] = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+}
+
+PerfCounters::~PerfCounters() {
+  for (auto fd : fds) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+bool PerfCounters::available() const {
+  for (auto fd : fds) {
+    if (fd < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void PerfCounters::start() {
+  if (!available()) {
+    return;
+  }
+  for (auto fd : fds) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+  }
+  for (auto fd : fds) {
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+PerfCounters::Reading PerfCounters::stop() {
+  auto result = Reading{};
+  if (!available()) {
+    return result;
+  }
+  for (auto fd : fds) {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  }
+
+  uint64_t* values[kNumCounters] = {&result.cycles, &result.instructions,
+                                    &result.cacheMisses};
+  for (int i = 0; i < kNumCounters; i++) {
+    if (read(fds[i], values[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+      *values[i] = 0;
+    }
+  }
+  return result;
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+  for (auto& fd : fds) {
+    fd = -1;
+  }
+}
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::available() const { return false; }
+
+void PerfCounters::start() {}
+
+PerfCounters::Reading PerfCounters::stop() { return Reading{}; }
+
+#endif
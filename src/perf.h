@@ -0,0 +1,35 @@
+#ifndef _PERF_H_
+#define _PERF_H_
+
+#include <cstdint>
+
+// Hardware counters for the calling thread, read with perf_event_open. Only
+// user space is counted, so this works with the default perf_event_paranoid.
+// Where the kernel won't hand them out (not Linux, no PMU in a VM) available()
+// is false and readings are all zero.
+class PerfCounters {
+ public:
+  struct Reading {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t cacheMisses = 0;
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available() const;
+
+  // Counts from start() to stop()
+  void start();
+  Reading stop();
+
+ private:
+  enum { kCycles, kInstructions, kCacheMisses, kNumCounters };
+  int fds[kNumCounters];
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "pipeline.h"
+
+#include <fstream>
+#include <functional>
+#include <iterator>
+
+#include "gif.h"
+
+#include <opencv2/highgui/highgui.hpp>
+
+void findPanels(Context& ctx);
+void findTextRegions(Context& ctx);
+void untypeset(Context& ctx);
+void attributeDialog(Context& ctx);
+
+Context::Context(const std::string& file, const Models& models_, bool debug_)
+    : models(models_), debug{debug_} {
+  if (isGifFile(file)) {
+    std::ifstream in{file, std::ios::binary};
+    const auto data = std::vector<uchar>(std::istreambuf_iterator<char>{in},
+                                         std::istreambuf_iterator<char>{});
+    decodeGif(data, img, nullptr);
+    return;
+  }
+
+  img = cv::imread(file, CV_LOAD_IMAGE_GRAYSCALE);
+  if (img.dims == 0) {
+    throw std::runtime_error{"Couldn't load: " + file};
+  }
+}
+
+Context::Context(const std::vector<uchar>& encoded, const Models& models_,
+                 bool debug_)
+    : models(models_), debug{debug_} {
+  if (isGif(encoded)) {
+    decodeGif(encoded, img, nullptr);
+    return;
+  }
+
+  img = cv::imdecode(encoded, CV_LOAD_IMAGE_GRAYSCALE);
+  if (img.dims == 0) {
+    throw std::runtime_error{"Couldn't decode image"};
+  }
+}
+
+void hackOutStarringPanel(Context& ctx) {
+  ctx.panels[0]
+      .dialog.clear();  // TODO: are there any comics where this is wrong?
+}
+
+void printComic(Context& ctx, std::ostream& out) {
+  for (const auto& panel : ctx.panels) {
+    for (const auto& bubble : panel.dialog) {
+      if (bubble.actor != "") {
+        out << bubble.actor << ": ";
+      }
+      out << bubble.contents << "\n";
+    }
+  }
+}
+
+void process(Context& ctx) {
+  ScopedTimer timer{ctx.stats, "process"};
+  {
+    ScopedTimer timer{ctx.stats, "findPanels"};
+    findPanels(ctx);
+  }
+  {
+    ScopedTimer timer{ctx.stats, "findTextRegions"};
+    findTextRegions(ctx);
+  }
+  ctx.stats.count("panels", ctx.panels.size());
+  ctx.stats.count("textRegions", ctx.textRegions.size());
+  {
+    ScopedTimer timer{ctx.stats, "untypeset"};
+    untypeset(ctx);
+  }
+  {
+    ScopedTimer timer{ctx.stats, "attributeDialog"};
+    attributeDialog(ctx);
+  }
+  hackOutStarringPanel(ctx);
+}
+
+namespace {
+
+ComicResult runComic(const std::function<Context()>& load,
+                     const std::string& name, const RunSettings& settings,
+                     WorkStealingPool* pool) {
+  auto result = ComicResult{};
+  try {
+    auto ctx = load();
+    ctx.debugJson = settings.debugJson;
+    ctx.proposeTextRegions = settings.textRegions;
+    ctx.matchEngine = settings.matchEngine;
+    ctx.actorEngine = settings.actorEngine;
+    ctx.actorCache = settings.actorCache;
+    if (settings.stats) {
+      ctx.stats.enable();
+    }
+    ctx.pool = pool;
+
+    if (ctx.debugJson) {
+      ctx.debugOut << "{\n";
+    }
+
+    try {
+      process(ctx);
+    }
+    catch (...) {
+      result.log = ctx.debugOut.str();
+      result.stats = ctx.stats.snapshot();
+      result.overlay = std::move(ctx.overlay);
+      throw;
+    }
+
+    if (ctx.debugJson) {
+      ctx.debugOut << "}";
+    }
+
+    auto transcript = std::ostringstream{};
+    printComic(ctx, transcript);
+    result.transcript = transcript.str();
+    result.panels = std::move(ctx.panels);
+    result.log = ctx.debugOut.str();
+    result.stats = ctx.stats.snapshot();
+    result.overlay = std::move(ctx.overlay);
+    result.ok = true;
+  }
+  catch (const std::exception& e) {
+    result.ok = false;
+    result.log += name + ": " + e.what() + "\n";
+  }
+  return result;
+}
+
+}  // namespace
+
+ComicResult runComic(const Models& models, const std::string& inFile,
+                     const RunSettings& settings, WorkStealingPool* pool) {
+  return runComic(
+      [&] { return Context{inFile, models, settings.debugOverlay}; }, inFile,
+      settings, pool);
+}
+
+ComicResult runComic(const Models& models, const std::vector<uchar>& encoded,
+                     const std::string& name, const RunSettings& settings,
+                     WorkStealingPool* pool) {
+  return runComic(
+      [&] { return Context{encoded, models, settings.debugOverlay}; }, name,
+      settings, pool);
+}
@@ -0,0 +1,41 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "context.h"
+
+class WorkStealingPool;
+
+// Knobs that apply to every comic in a run
+struct RunSettings {
+  bool debugJson = false;
+  bool debugOverlay = false;  // record ComicResult::overlay
+  bool textRegions = false;  // see findTextRegions
+  MatchEngine matchEngine = MatchEngine::Direct;
+  ActorEngine actorEngine = ActorEngine::Sift;
+  ActorCache* actorCache = nullptr;
+  bool stats = false;
+};
+
+struct ComicResult {
+  bool ok = false;
+  std::string transcript;
+  std::vector<Panel> panels;  // what the transcript was printed from
+  std::string log;  // debug JSON and error text, destined for stderr
+  StageStats stats;  // empty unless RunSettings::stats
+  DebugOverlay overlay;  // empty unless RunSettings::debugOverlay
+};
+
+void process(Context& ctx);
+void printComic(Context& ctx, std::ostream& out);
+
+// Runs a single comic start to finish. Errors are captured in the result
+// rather than thrown so that batch runs can carry on.
+ComicResult runComic(const Models& models, const std::string& inFile,
+                     const RunSettings& settings, WorkStealingPool* pool);
+// The same for a comic already in memory (see Context). `name` only labels
+// errors.
+ComicResult runComic(const Models& models, const std::vector<uchar>& encoded,
+                     const std::string& name, const RunSettings& settings,
+                     WorkStealingPool* pool);
+
+#endif
@@ -0,0 +1,98 @@
+#include "pool.h"
+
+#include "context.h"
+
+namespace {
+// Lets submit() and tryRunOne() know which queue belongs to the current thread
+thread_local const WorkStealingPool* tlsPool = nullptr;
+thread_local size_t tlsIndex = 0;
+}
+
+WorkStealingPool::WorkStealingPool(size_t numThreads) {
+  ASSERT(numThreads > 0);
+  for (size_t i = 0; i < numThreads; i++) {
+    queues.emplace_back(new Queue{});
+  }
+  for (size_t i = 0; i < numThreads; i++) {
+    workers.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock{sleepMutex};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+  auto index = tlsPool == this ? tlsIndex : nextQueue++ % queues.size();
+  {
+    // Count the task before it becomes visible so a thief can never take the
+    // count below zero
+    std::lock_guard<std::mutex> lock{sleepMutex};
+    queued++;
+  }
+  {
+    std::lock_guard<std::mutex> lock{queues[index]->mutex};
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+size_t WorkStealingPool::currentQueue() const {
+  return tlsPool == this ? tlsIndex : 0;
+}
+
+bool WorkStealingPool::tryRunOne(size_t self) {
+  std::function<void()> task;
+
+  for (size_t i = 0; i < queues.size() && !task; i++) {
+    auto& queue = *queues[(self + i) % queues.size()];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.tasks.empty()) {
+      continue;
+    }
+    // Our own deque is used LIFO (the most recently pushed work is likely
+    // still in cache), victims are robbed FIFO.
+    if (i == 0) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+    } else {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+    }
+  }
+
+  if (!task) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock{sleepMutex};
+    queued--;
+  }
+  task();
+  return true;
+}
+
+void WorkStealingPool::workerLoop(size_t self) {
+  tlsPool = this;
+  tlsIndex = self;
+
+  while (true) {
+    if (tryRunOne(self)) {
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock{sleepMutex};
+    wake.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping && queued == 0) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each owning a deque of tasks. A worker pops
+// work from the back of its own deque and, once that runs dry, steals from the
+// front of the others'. Comics vary wildly in how long they take, so this keeps
+// every core busy where handing out fixed chunks would not.
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(size_t numThreads);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  // Tasks must not throw. Submitting from inside a task pushes onto the
+  // calling worker's own deque.
+  void submit(std::function<void()> task);
+
+  // Runs fn(0) .. fn(n - 1) on the pool and returns once all of them are done.
+  // The calling thread works through queued tasks while it waits, so this is
+  // safe to call from inside a task. The first exception thrown by fn is
+  // rethrown here.
+  template <class F>
+  void parallelFor(size_t n, F fn);
+
+  size_t size() const { return workers.size(); }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool tryRunOne(size_t self);
+  void workerLoop(size_t self);
+  size_t currentQueue() const;
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  size_t queued = 0;  // guarded by sleepMutex
+  bool stopping = false;
+  std::atomic<size_t> nextQueue{0};
+};
+
+template <class F>
+void WorkStealingPool::parallelFor(size_t n, F fn) {
+  std::atomic<size_t> remaining{n};
+  std::mutex mutex;
+  std::condition_variable allDone;
+  std::exception_ptr error;
+
+  for (size_t i = 0; i < n; i++) {
+    submit([&, i] {
+      try {
+        fn(i);
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock{mutex};
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+      // Decrement under the lock so the waiter can't see zero (and tear down
+      // these locals) before we are done notifying
+      std::lock_guard<std::mutex> lock{mutex};
+      if (--remaining == 0) {
+        allDone.notify_all();
+      }
+    });
+  }
+
+  const auto self = currentQueue();
+  while (remaining > 0 && tryRunOne(self)) {
+  }
+
+  std::unique_lock<std::mutex> lock{mutex};
+  allDone.wait(lock, [&] { return remaining == 0; });
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "rectgrid.h"
+
+RectGrid::RectGrid(const std::vector<cv::Rect>& rects_, int cellSize_)
+    : rects{rects_}, cellSize{std::max(1, cellSize_)} {
+  if (rects.empty()) {
+    return;
+  }
+
+  auto bounds = rects[0];
+  for (const auto& r : rects) {
+    bounds |= r;
+  }
+  origin = bounds.tl();
+  cells = cv::Size{bounds.width / cellSize + 1, bounds.height / cellSize + 1};
+  buckets.resize(cells.area());
+
+  // Inserting in index order keeps every bucket sorted
+  for (size_t i = 0; i < rects.size(); i++) {
+    auto range = cellRange(rects[i]);
+    for (int y = range.y; y < range.y + range.height; y++) {
+      for (int x = range.x; x < range.x + range.width; x++) {
+        buckets[y * cells.width + x].push_back(i);
+      }
+    }
+  }
+}
+
+// The cells covered by r, clipped to the grid
+cv::Rect RectGrid::cellRange(const cv::Rect& r) const {
+  auto x0 = std::max(0, (r.x - origin.x) / cellSize);
+  auto y0 = std::max(0, (r.y - origin.y) / cellSize);
+  auto x1 = std::min(cells.width - 1,
+                     (r.x + std::max(1, r.width) - 1 - origin.x) / cellSize);
+  auto y1 = std::min(cells.height - 1,
+                     (r.y + std::max(1, r.height) - 1 - origin.y) / cellSize);
+  return cv::Rect{x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+}
+
+void RectGrid::query(const cv::Rect& r, std::vector<size_t>& out) const {
+  out.clear();
+  if (rects.empty() || r.x >= origin.x + cells.width * cellSize ||
+      r.y >= origin.y + cells.height * cellSize || r.x + r.width <= origin.x ||
+      r.y + r.height <= origin.y) {
+    return;
+  }
+
+  auto range = cellRange(r);
+  for (int y = range.y; y < range.y + range.height; y++) {
+    for (int x = range.x; x < range.x + range.width; x++) {
+      for (auto i : buckets[y * cells.width + x]) {
+        if ((rects[i] & r).area() > 0) {
+          out.push_back(i);
+        }
+      }
+    }
+  }
+
+  // A rect spanning several cells turns up once per cell
+  std::sort(out.begin(), out.end());
+  out.erase(std::unique(out.begin(), out.end()), out.end());
+}
+
+namespace {
+
+int floorDiv(int a, int b) { return a / b - (a % b != 0 && (a < 0) != (b < 0)); }
+
+}  // namespace
+
+SpatialHash::SpatialHash(cv::Size cellSize_)
+    : cellSize{std::max(1, cellSize_.width), std::max(1, cellSize_.height)} {}
+
+template <class F>
+void SpatialHash::forEachCell(const cv::Rect& r, F f) const {
+  auto x0 = floorDiv(r.x, cellSize.width);
+  auto y0 = floorDiv(r.y, cellSize.height);
+  auto x1 = floorDiv(r.x + std::max(1, r.width) - 1, cellSize.width);
+  auto y1 = floorDiv(r.y + std::max(1, r.height) - 1, cellSize.height);
+  for (int64_t y = y0; y <= y1; y++) {
+    for (int64_t x = x0; x <= x1; x++) {
+      f((y << 32) ^ (x & 0xffffffff));
+    }
+  }
+}
+
+void SpatialHash::insert(const cv::Rect& r, size_t id) {
+  forEachCell(r, [&](int64_t key) { cells[key].push_back(id); });
+}
+
+void SpatialHash::query(const cv::Rect& r, std::vector<size_t>& out) const {
+  forEachCell(r, [&](int64_t key) {
+    auto cell = cells.find(key);
+    if (cell != cells.end()) {
+      out.insert(out.end(), cell->second.begin(), cell->second.end());
+    }
+  });
+}
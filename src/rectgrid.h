@@ -0,0 +1,50 @@
+#ifndef _RECTGRID_H_
+#define _RECTGRID_H_
+
+#include "context.h"
+
+#include <unordered_map>
+
+// A uniform grid over a fixed set of rects. Each rect is filed under every cell
+// it touches, so finding the rects that might overlap a given one only looks at
+// its neighbourhood. Works best when the cells are about as big as the rects.
+class RectGrid {
+ public:
+  RectGrid(const std::vector<cv::Rect>& rects, int cellSize);
+
+  // Indices of every rect that intersects r (with a non-empty intersection), in
+  // increasing order
+  void query(const cv::Rect& r, std::vector<size_t>& out) const;
+
+ private:
+  cv::Rect cellRange(const cv::Rect& r) const;
+
+  std::vector<cv::Rect> rects;
+  int cellSize;
+  cv::Point origin;
+  cv::Size cells;
+  std::vector<std::vector<size_t>> buckets;  // row major, cells.area() of them
+};
+
+// An unbounded grid that rects can keep being filed into as they change.
+// Nothing is ever removed, so lookups can turn up stale ids and callers have to
+// check every hit themselves.
+class SpatialHash {
+ public:
+  explicit SpatialHash(cv::Size cellSize);
+
+  void insert(const cv::Rect& r, size_t id);
+
+  // Appends the ids filed under every cell r touches. The same id may come up
+  // more than once.
+  void query(const cv::Rect& r, std::vector<size_t>& out) const;
+
+ private:
+  template <class F>
+  void forEachCell(const cv::Rect& r, F f) const;
+
+  cv::Size cellSize;
+  std::unordered_map<int64_t, std::vector<size_t>> cells;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "context.h"
+
+#include <numeric>
+
+namespace {
+
+// Disjoint set forest over rect indexes
+class UnionFind {
+ public:
+  explicit UnionFind(size_t n) : parent(n) {
+    std::iota(parent.begin(), parent.end(), 0);
+  }
+
+  size_t find(size_t i) {
+    while (parent[i] != i) {
+      parent[i] = parent[parent[i]];
+      i = parent[i];
+    }
+    return i;
+  }
+
+  // Whether the two were apart before
+  bool join(size_t a, size_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+      return false;
+    }
+    parent[std::max(a, b)] = std::min(a, b);
+    return true;
+  }
+
+ private:
+  std::vector<size_t> parent;
+};
+
+}  // namespace
+
+// Grows rects into their neighbours until no two are closer than `gap` on both
+// axes. The result is a set of disjoint rects that are far enough apart that
+// scanning them separately behaves like scanning the whole image.
+//
+// Each pass sweeps the rects in order of left edge, joins every pair that is
+// close enough and replaces each group by its bounding rect. A merged rect can
+// reach neighbours none of its parts did, so passes repeat until one joins
+// nothing; in practice that is the second.
+std::vector<cv::Rect> mergeNearbyRects(std::vector<cv::Rect> rects,
+                                       cv::Size gap) {
+  while (rects.size() > 1) {
+    std::vector<size_t> byLeft(rects.size());
+    std::iota(byLeft.begin(), byLeft.end(), 0);
+    std::sort(byLeft.begin(), byLeft.end(), [&](size_t a, size_t b) {
+      return rects[a].x < rects[b].x;
+    });
+
+    auto groups = UnionFind{rects.size()};
+    auto joined = false;
+    for (size_t i = 0; i < byLeft.size(); i++) {
+      const auto& r = rects[byLeft[i]];
+      auto grown = cv::Rect{r.x - gap.width, r.y - gap.height,
+                            r.width + 2 * gap.width,
+                            r.height + 2 * gap.height};
+      // Everything further along starts at or right of r.x, so stop at the
+      // first one that starts past the grown rect
+      for (size_t j = i + 1; j < byLeft.size(); j++) {
+        const auto& other = rects[byLeft[j]];
+        if (other.x >= grown.x + grown.width) {
+          break;
+        }
+        if ((grown & other).area() != 0) {
+          joined |= groups.join(byLeft[i], byLeft[j]);
+        }
+      }
+    }
+    if (!joined) {
+      break;
+    }
+
+    // Each group ends up where its first rect was
+    std::vector<cv::Rect> merged;
+    std::vector<size_t> slot(rects.size());
+    for (size_t i = 0; i < rects.size(); i++) {
+      const auto root = groups.find(i);
+      if (root == i) {
+        slot[i] = merged.size();
+        merged.push_back(rects[i]);
+      } else {
+        merged[slot[root]] |= rects[i];
+      }
+    }
+    rects = std::move(merged);
+  }
+  return rects;
+}
+
+// Does this (glyph sized) rect sit on a white background? Checked by looking at
+// the ring of pixels just outside of it.
+bool onWhiteBackground(const cv::Mat& img, cv::Rect r) {
+  const uint8_t kBasicallyWhite = 200;
+  const float kMinWhiteRatio = 0.8f;
+
+  auto ring = cv::Rect{r.x - 1, r.y - 1, r.width + 2, r.height + 2} &
+              cv::Rect{{0, 0}, img.size()};
+
+  size_t white = 0;
+  size_t total = 0;
+  for (int y = ring.y; y < ring.y + ring.height; y++) {
+    auto row = img.ptr<uint8_t>(y);
+    auto edge = y == ring.y || y == ring.y + ring.height - 1;
+    for (int x = ring.x; x < ring.x + ring.width;
+         x += edge ? 1 : std::max(1, ring.width - 1)) {
+      white += row[x] >= kBasicallyWhite;
+      total++;
+    }
+  }
+  return total > 0 && white >= kMinWhiteRatio * total;
+}
+
+// Cheap pre-pass that proposes the parts of the comic that might hold text, so
+// findGlyphs doesn't have to slide every template over the artwork. A text
+// region is a cluster of dark, glyph sized strokes sitting on white.
+//
+// Off unless asked for (--text-regions): lettering that touches a bubble
+// outline joins the outline's blob and is never proposed, and nobody has yet
+// compared a jerkcity-regress run with and without it.
+void findTextRegions(Context& ctx) {
+  ctx.textRegions.clear();
+
+  if (!ctx.proposeTextRegions) {
+    ctx.textRegions.emplace_back(cv::Point{0, 0}, ctx.img.size());
+    return;
+  }
+
+  const uint8_t kInk = 127;   // Anything darker than this might be lettering
+  const auto kJoinX = 16;     // Roughly the widest gap between words
+  const auto kJoinY = 8;      // Roughly the widest gap between lines
+  const auto kMinStrokes = 2; // Unless the one stroke could be a letter
+  const auto kPadding = 4;
+
+  auto maxGlyph = cv::Size{1, 1};
+  for (const auto& tmpl : ctx.models.glyphs) {
+    maxGlyph.width = std::max(maxGlyph.width, tmpl.img.cols);
+    maxGlyph.height = std::max(maxGlyph.height, tmpl.img.rows);
+  }
+  // A bubble holding just "I" or "A" is one stroke, but a capital's height
+  // sets it apart from a speck of shading
+  const auto isLoneLetter = [&](const cv::Rect& s) {
+    return 2 * s.height >= maxGlyph.height && s.width <= maxGlyph.width + 2;
+  };
+
+  std::vector<cv::Rect> regions;
+
+  // The starring panel is blanked out by findPanels, so skip it
+  for (size_t i = 1; i < ctx.panels.size(); i++) {
+    const auto& bounds = ctx.panels[i].bounds;
+    auto panelImg = cv::Mat{ctx.img, bounds};
+
+    auto ink = cv::Mat{};
+    cv::threshold(panelImg, ink, kInk, 255, CV_THRESH_BINARY_INV);
+
+    // Every blob of ink, including the lettering inside a closed bubble
+    // outline or panel border: CCOMP puts the outer boundary of each blob at
+    // the top level, whatever it sits inside, and the holes in it below
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<cv::Vec4i> hierarchy;
+    cv::findContours(ink, contours, hierarchy, CV_RETR_CCOMP,
+                     CV_CHAIN_APPROX_SIMPLE);
+
+    // Touching letters show up as a single stroke, so allow a few glyphs wide
+    std::vector<cv::Rect> strokes;
+    auto strokeMask = cv::Mat{panelImg.size(), CV_8U, cv::Scalar{0}};
+    for (size_t c = 0; c < contours.size(); c++) {
+      const auto isHole = hierarchy[c][3] >= 0;
+      if (isHole) {
+        continue;
+      }
+      auto r = cv::boundingRect(contours[c]);
+      if (r.height > maxGlyph.height + 2 || r.width > 4 * maxGlyph.width ||
+          !onWhiteBackground(panelImg, r)) {
+        continue;
+      }
+      strokes.push_back(r);
+      cv::rectangle(strokeMask, r, cv::Scalar{255}, CV_FILLED);
+    }
+
+    // Smear neighbouring strokes together into clusters
+    auto kernel = cv::getStructuringElement(cv::MORPH_RECT,
+                                            cv::Size{kJoinX, kJoinY});
+    cv::dilate(strokeMask, strokeMask, kernel);
+
+    std::vector<std::vector<cv::Point>> clusters;
+    cv::findContours(strokeMask, clusters, CV_RETR_EXTERNAL,
+                     CV_CHAIN_APPROX_SIMPLE);
+
+    for (const auto& cluster : clusters) {
+      auto r = cv::boundingRect(cluster);
+      auto count = 0;
+      auto lone = cv::Rect{};
+      for (const auto& s : strokes) {
+        if (r.contains({s.x + s.width / 2, s.y + s.height / 2})) {
+          count++;
+          lone = s;
+        }
+      }
+      if (count < kMinStrokes && !(count == 1 && isLoneLetter(lone))) {
+        continue;
+      }
+
+      r = cv::Rect{r.x - kPadding + bounds.x, r.y - kPadding + bounds.y,
+                   r.width + 2 * kPadding, r.height + 2 * kPadding};
+      regions.push_back(r & bounds);
+    }
+  }
+
+  // Keep regions a template's width apart so that a match can't be affected
+  // by which region it was found in
+  ctx.textRegions = mergeNearbyRects(regions, maxGlyph);
+
+  if (ctx.debugJson) {
+    ctx.debugOut << "\t\"textRegions\": [\n";
+    for (const auto& r : ctx.textRegions) {
+      ctx.debugOut << "\t\t{ ";
+      printRectJson(ctx.debugOut, r);
+      ctx.debugOut << " },\n";
+    }
+    ctx.debugOut << "\t],\n";
+  }
+
+  if (ctx.debug) {
+    for (const auto& r : ctx.textRegions) {
+      ctx.overlay.rect(DebugStage::TextRegions, r, {255, 0, 0}, 1);
+    }
+  }
+}
@@ -0,0 +1,288 @@
+#include "actorcache.h"
+#include "actors.h"
+#include "context.h"
+#include "corpus.h"
+#include "glyphmatch.h"
+#include "groundtruth.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+namespace fs = boost::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+// Runs a comic on a thread of its own and gives up on it after `timeoutMs`
+// (unless that is 0), failing it as tests/test.sh does when it kills jerkcity.
+// A comic given up on is left running with nowhere to put its result, and
+// counted in `abandoned`.
+ComicResult runComicWithin(double timeoutMs, const Models& models,
+                           const std::string& inFile,
+                           const RunSettings& settings,
+                           std::atomic<size_t>& abandoned) {
+  if (timeoutMs <= 0) {
+    return runComic(models, inFile, settings, nullptr);
+  }
+
+  struct Job {
+    std::mutex mutex;
+    std::condition_variable done;
+    bool finished = false;
+    ComicResult result;
+  };
+  auto job = std::make_shared<Job>();
+  std::thread{[job, &models, inFile, settings] {
+    auto result = runComic(models, inFile, settings, nullptr);
+    std::lock_guard<std::mutex> lock{job->mutex};
+    job->result = std::move(result);
+    job->finished = true;
+    job->done.notify_one();
+  }}.detach();
+
+  std::unique_lock<std::mutex> lock{job->mutex};
+  if (!job->done.wait_for(lock,
+                          std::chrono::duration<double, std::milli>(timeoutMs),
+                          [&] { return job->finished; })) {
+    abandoned++;
+    auto result = ComicResult{};
+    result.log = inFile + ": gave up after " +
+                 std::to_string(static_cast<long>(timeoutMs)) + " ms\n";
+    return result;
+  }
+  return std::move(job->result);
+}
+
+// Runs the pipeline in-process over every locally downloaded comic that
+// tests/dialog.xml has dialog for, and sorts the results into the same buckets
+// as tests/test.sh
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = po::options_description{"Allowed options"};
+  desc.add_options()("help", "this message")(
+      "dialog", po::value<std::string>()->default_value("../tests/dialog.xml"),
+      "expected transcripts")(
+      "images", po::value<std::string>()->default_value("../tests/img"),
+      "directory of comics named <issue>.png or <issue>.gif")(
+      "models", po::value<std::string>(),
+      "model bundle built by jerkcity-pack")(
+      "first", po::value<int>()->default_value(1), "first issue to run")(
+      "last", po::value<int>()->default_value(0),
+      "last issue to run (0 = the last one in --dialog)")(
+      "jobs", po::value<size_t>()->default_value(0),
+      "worker threads (0 = one per core)")(
+      "verbose", "print expected and actual dialog of every issue that fails")(
+      "timeout", po::value<double>()->default_value(10),
+      "seconds after which a comic counts as failed, as tests/test.sh kills "
+      "jerkcity after 10 (0 = wait for every comic)")(
+      "text-regions",
+      "only search for glyphs in the areas that look like text, rather than "
+      "the whole comic (faster, but untested against the corpus)")(
+      "match-engine", po::value<std::string>()->default_value("direct"),
+      "how glyph templates are matched: direct, fft or binary")(
+      "actor-engine", po::value<std::string>()->default_value("sift"),
+      "how speakers are recognized: sift, orb or sift-reference (the slow "
+      "matcher sift replaced)")(
+      "compare-actor-engine", po::value<std::string>(),
+      "also run every comic with this actor engine and report the bubbles "
+      "whose speakers differ")(
+      "actor-cache-radius", po::value<int>()->default_value(-1),
+      "as for jerkcity: off by default, since a cache shared between threads "
+      "makes the results depend on scheduling");
+
+  auto vm = po::variables_map{};
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return -1;
+  }
+
+  const auto truth = GroundTruth{vm["dialog"].as<std::string>()};
+  const auto models =
+      loadModels(vm.count("models") ? vm["models"].as<std::string>() : "");
+  const auto verbose = vm.count("verbose") != 0;
+  const auto timeoutMs = 1000 * vm["timeout"].as<double>();
+
+  auto settings = RunSettings{};
+  settings.textRegions = vm.count("text-regions") != 0;
+  settings.matchEngine =
+      parseMatchEngine(vm["match-engine"].as<std::string>());
+  settings.actorEngine =
+      parseActorEngine(vm["actor-engine"].as<std::string>());
+  auto cache = std::unique_ptr<ActorCache>{};
+  if (vm["actor-cache-radius"].as<int>() >= 0) {
+    cache.reset(new ActorCache{vm["actor-cache-radius"].as<int>()});
+    settings.actorCache = cache.get();
+  }
+
+  auto compareSettings = settings;
+  const auto compare = vm.count("compare-actor-engine") != 0;
+  if (compare) {
+    compareSettings.actorEngine =
+        parseActorEngine(vm["compare-actor-engine"].as<std::string>());
+  }
+
+  const auto first = vm["first"].as<int>();
+  const auto last = vm["last"].as<int>();
+  std::vector<std::string> inputs;
+  std::unordered_map<std::string, int> issueOf;
+  size_t missing = 0;
+  for (auto issue : truth.issues()) {
+    if (issue < first || (last > 0 && issue > last)) {
+      continue;
+    }
+    const auto stem =
+        fs::path{vm["images"].as<std::string>()} / std::to_string(issue);
+    auto file = stem.string() + ".png";
+    if (!fs::is_regular_file(file)) {
+      file = stem.string() + ".gif";
+    }
+    if (!fs::is_regular_file(file)) {
+      missing++;
+      continue;
+    }
+    issueOf[file] = issue;
+    inputs.push_back(file);
+  }
+
+  auto jobs = vm["jobs"].as<size_t>();
+  if (jobs == 0) {
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+  }
+  if (jobs > 1) {
+    cv::setNumThreads(0);
+  }
+
+  // Each comic only ever writes its own slot
+  std::unordered_map<std::string, size_t> slotOf;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    slotOf[inputs[i]] = i;
+  }
+  std::vector<double> runtimes(inputs.size());
+  std::vector<std::vector<std::string>> compareActors(inputs.size());
+
+  std::map<Verdict, size_t> verdicts;
+  size_t charErrors = 0;
+  size_t expectedChars = 0;
+  size_t comparedBubbles = 0;
+  size_t differentSpeakers = 0;
+  size_t comicsWithDifferentSpeakers = 0;
+
+  std::atomic<size_t> abandoned{0};
+
+  auto start = Clock::now();
+  WorkStealingPool pool{jobs};
+  transcribeCorpus(
+      pool, inputs,
+      [&](const std::string& inFile) {
+        auto comicStart = Clock::now();
+        auto result =
+            runComicWithin(timeoutMs, models, inFile, settings, abandoned);
+        runtimes[slotOf.at(inFile)] =
+            std::chrono::duration<double, std::milli>(Clock::now() -
+                                                      comicStart)
+                .count();
+        if (compare) {
+          auto other = runComicWithin(timeoutMs, models, inFile,
+                                      compareSettings, abandoned);
+          for (const auto& panel : other.panels) {
+            for (const auto& bubble : panel.dialog) {
+              compareActors[slotOf.at(inFile)].push_back(bubble.actor);
+            }
+          }
+        }
+        return result;
+      },
+      [&](const std::string& inFile, const ComicResult& result) {
+        const auto issue = issueOf.at(inFile);
+        const auto& expected = *truth.dialog(issue);
+        const auto actual = normalizeTranscript(result.transcript);
+        const auto verdict = result.ok ? judge(expected, actual)
+                                       : Verdict::Failed;
+        verdicts[verdict]++;
+
+        if (compare) {
+          // Speaker recognition comes after everything that finds the
+          // bubbles, so both runs have the same bubbles in the same order
+          const auto& others = compareActors[slotOf.at(inFile)];
+          size_t b = 0;
+          size_t differ = 0;
+          for (const auto& panel : result.panels) {
+            for (const auto& bubble : panel.dialog) {
+              differ += b >= others.size() || others[b] != bubble.actor;
+              b++;
+            }
+          }
+          comparedBubbles += b;
+          differentSpeakers += differ;
+          comicsWithDifferentSpeakers += differ > 0;
+          if (differ > 0) {
+            std::cout << issue << ": " << differ << " of " << b
+                      << " speakers differ from "
+                      << vm["compare-actor-engine"].as<std::string>() << "\n";
+          }
+        }
+
+        if (result.ok && !expected.empty()) {
+          const auto expectedWords = dialogWords(expected);
+          charErrors += editDistance(expectedWords, dialogWords(actual));
+          expectedChars += expectedWords.size();
+        }
+
+        if (verdict != Verdict::Pass && verdict != Verdict::NoExpected) {
+          std::cout << issue << ": " << verdictName(verdict) << "\n";
+          if (verbose) {
+            std::cout << result.log << "--- expected\n" << expected
+                      << "\n--- actual\n" << actual << "\n\n";
+          }
+        }
+      });
+  auto totalMs =
+      std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+  std::cout << "\n";
+  for (auto verdict : {Verdict::Pass, Verdict::Cast, Verdict::Dialog,
+                       Verdict::LineCount, Verdict::Failed,
+                       Verdict::NoExpected}) {
+    std::cout << verdictName(verdict) << ": " << verdicts[verdict] << "\n";
+  }
+  std::cout << "not downloaded: " << missing << "\n";
+  std::cout << "timed out: " << abandoned << "\n";
+  if (compare) {
+    std::cout << "speakers differing from "
+              << vm["compare-actor-engine"].as<std::string>() << ": "
+              << differentSpeakers << " of " << comparedBubbles
+              << " bubbles, in " << comicsWithDifferentSpeakers << " comics\n";
+  }
+  std::cout << "character error rate: "
+            << (expectedChars ? 100.0 * charErrors / expectedChars : 0.0)
+            << "%\n";
+
+  std::sort(runtimes.begin(), runtimes.end());
+  std::cout << "runtime: " << totalMs / 1000 << " s for " << inputs.size()
+            << " comics on " << jobs << " threads; per comic p50 "
+            << percentile(runtimes, 0.5) << " ms, p90 "
+            << percentile(runtimes, 0.9) << " ms, p99 "
+            << percentile(runtimes, 0.99) << " ms, max "
+            << percentile(runtimes, 1.0) << " ms\n";
+
+  if (abandoned > 0) {
+    // Comics given up on may still be running on the models, so don't wait
+    // for them or tear anything down under them
+    std::cout.flush();
+    std::_Exit(0);
+  }
+}
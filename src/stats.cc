@@ -0,0 +1,143 @@
+#include "stats.h"
+
+#include <algorithm>
+
+void StatsRecorder::add(const char* name, size_t n) {
+  std::lock_guard<std::mutex> lock{mutex};
+  stats.counts[name] += n;
+}
+
+void StatsRecorder::addTime(const char* name, double ms) {
+  std::lock_guard<std::mutex> lock{mutex};
+  stats.ms[name] += ms;
+}
+
+StageStats StatsRecorder::snapshot() const {
+  std::lock_guard<std::mutex> lock{mutex};
+  return stats;
+}
+
+namespace {
+
+template <class T>
+void printJsonObject(std::ostream& out, const std::map<std::string, T>& values) {
+  out << "{";
+  auto first = true;
+  for (const auto& value : values) {
+    out << (first ? "" : ", ");
+    printJsonString(out, value.first);
+    out << ": " << value.second;
+    first = false;
+  }
+  out << "}";
+}
+
+void printSummaryObject(std::ostream& out,
+                        std::map<std::string, std::vector<double>> values,
+                        bool compact) {
+  out << "{";
+  auto first = true;
+  for (auto& value : values) {
+    auto& sorted = value.second;
+    std::sort(sorted.begin(), sorted.end());
+    auto total = 0.0;
+    for (auto v : sorted) {
+      total += v;
+    }
+
+    if (compact) {
+      out << (first ? "" : ", ");
+    } else {
+      out << (first ? "\n" : ",\n") << "    ";
+    }
+    printJsonString(out, value.first);
+    out << ": {\"total\": " << total
+        << ", \"p50\": " << percentile(sorted, 0.5)
+        << ", \"p90\": " << percentile(sorted, 0.9)
+        << ", \"p99\": " << percentile(sorted, 0.99)
+        << ", \"max\": " << percentile(sorted, 1.0) << "}";
+    first = false;
+  }
+  out << (compact ? "}" : "\n  }");
+}
+
+}  // namespace
+
+void printStatsJson(std::ostream& out, const std::string& file,
+                    const StageStats& stats) {
+  out << "{\"file\": ";
+  printJsonString(out, file);
+  out << ", ";
+  printStatsMembers(out, stats);
+  out << "}\n";
+}
+
+void printStatsMembers(std::ostream& out, const StageStats& stats) {
+  out << "\"ms\": ";
+  printJsonObject(out, stats.ms);
+  out << ", \"counts\": ";
+  printJsonObject(out, stats.counts);
+}
+
+void printJsonString(std::ostream& out, const std::string& str) {
+  out << '"';
+  for (auto c : str) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c == '\n') {
+      out << "\\n";
+    } else if (c == '\t') {
+      out << "\\t";
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      out << ' ';
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(fraction * sorted.size());
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+void StatsSummary::add(const StageStats& stats) {
+  // A comic that never reached a stage counts as zero there, so percentiles are
+  // over every comic
+  auto fill = [this](std::vector<double>& values) {
+    values.resize(comics, 0.0);
+  };
+  for (const auto& value : stats.ms) {
+    fill(ms[value.first]);
+  }
+  for (const auto& value : stats.counts) {
+    fill(counts[value.first]);
+  }
+  for (auto& value : ms) {
+    fill(value.second);
+    auto it = stats.ms.find(value.first);
+    value.second.push_back(it != stats.ms.end() ? it->second : 0.0);
+  }
+  for (auto& value : counts) {
+    fill(value.second);
+    auto it = stats.counts.find(value.first);
+    value.second.push_back(it != stats.counts.end() ? it->second : 0.0);
+  }
+  comics++;
+}
+
+void StatsSummary::printJson(std::ostream& out, bool compact) const {
+  const auto* separator = compact ? ", " : ",\n  ";
+  out << (compact ? "{" : "{\n  ") << "\"comics\": " << comics << separator
+      << "\"runMs\": ";
+  printJsonObject(out, runMs);
+  out << separator << "\"ms\": ";
+  printSummaryObject(out, ms, compact);
+  out << separator << "\"counts\": ";
+  printSummaryObject(out, counts, compact);
+  out << (compact ? "}" : "\n}\n");
+}
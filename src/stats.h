@@ -0,0 +1,110 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Where one comic's time went and how much work each stage did
+struct StageStats {
+  std::map<std::string, double> ms;
+  std::map<std::string, size_t> counts;
+};
+
+// Collects a comic's StageStats. Until enable() is called every method is a
+// test of one bool, so stages can be instrumented unconditionally. Safe to
+// record into from several threads.
+class StatsRecorder {
+ public:
+  StatsRecorder() = default;
+  // Only so that Context can be returned by value. Nothing may be recording
+  // into `other` at the time.
+  StatsRecorder(StatsRecorder&& other)
+      : on{other.on}, stats(std::move(other.stats)) {}
+
+  void enable() { on = true; }
+  bool enabled() const { return on; }
+
+  void count(const char* name, size_t n = 1) {
+    if (on) {
+      add(name, n);
+    }
+  }
+  void time(const char* name, double ms) {
+    if (on) {
+      addTime(name, ms);
+    }
+  }
+
+  StageStats snapshot() const;
+
+ private:
+  void add(const char* name, size_t n);
+  void addTime(const char* name, double ms);
+
+  bool on = false;
+  mutable std::mutex mutex;
+  StageStats stats;
+};
+
+// Adds the time until it goes out of scope to the named timing
+class ScopedTimer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  ScopedTimer(StatsRecorder& stats_, const char* name_)
+      : stats(stats_), name{name_} {
+    if (stats.enabled()) {
+      start = Clock::now();
+    }
+  }
+  ~ScopedTimer() {
+    if (stats.enabled()) {
+      stats.time(name, std::chrono::duration<double, std::milli>(
+                           Clock::now() - start).count());
+    }
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+ private:
+  StatsRecorder& stats;
+  const char* name;
+  Clock::time_point start;
+};
+
+// One line of JSON: {"file": ..., "ms": {...}, "counts": {...}}
+void printStatsJson(std::ostream& out, const std::string& file,
+                    const StageStats& stats);
+// Just the "ms": {...}, "counts": {...} members, for a caller's own object
+void printStatsMembers(std::ostream& out, const StageStats& stats);
+
+// A quoted, escaped JSON string
+void printJsonString(std::ostream& out, const std::string& str);
+
+// The value below which `fraction` of the sorted values fall
+double percentile(const std::vector<double>& sorted, double fraction);
+
+// Every comic's StageStats in a run, summarized per timing and counter as a
+// total and p50/p90/p99/max over the comics
+class StatsSummary {
+ public:
+  void add(const StageStats& stats);
+  // Time spent once for the whole run rather than per comic
+  void addRunTime(const std::string& name, double ms) { runMs[name] += ms; }
+  // Indented over several lines, or if `compact` on one line with no newline
+  // at the end, for embedding in another object
+  void printJson(std::ostream& out, bool compact = false) const;
+
+ private:
+  size_t comics = 0;
+  std::map<std::string, double> runMs;
+  std::map<std::string, std::vector<double>> ms;
+  std::map<std::string, std::vector<double>> counts;
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "stream.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Reads the next comic into `out`. False at a clean end of the stream.
+bool readComic(std::istream& in, std::vector<uchar>& out) {
+  unsigned char header[4];
+  in.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (in.gcount() == 0 && in.eof()) {
+    return false;
+  }
+  if (in.gcount() != sizeof(header)) {
+    throw std::runtime_error{"Stream ended inside a length prefix"};
+  }
+
+  const auto size = uint32_t{header[0]} << 24 | uint32_t{header[1]} << 16 |
+                    uint32_t{header[2]} << 8 | uint32_t{header[3]};
+  if (size > kMaxComicBytes) {
+    throw std::runtime_error{"Comic of " + std::to_string(size) +
+                             " bytes in stream, is the framing wrong?"};
+  }
+  out.resize(size);
+  in.read(reinterpret_cast<char*>(out.data()), size);
+  if (static_cast<uint32_t>(in.gcount()) != size) {
+    throw std::runtime_error{"Stream ended inside a comic"};
+  }
+  return true;
+}
+
+}  // namespace
+
+void transcribeStream(
+    std::istream& in, std::ostream& out,
+    std::function<ComicResult(size_t index, const std::vector<uchar>&)>
+        transcribe) {
+  // One comic being read while another is transcribed. Holding more would
+  // only cost memory: the reader is never the slow side.
+  const size_t kReadAhead = 2;
+  // A tied `in` would flush `out` from the reader thread
+  in.tie(nullptr);
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<std::vector<uchar>> comics;
+  auto ended = false;
+  std::exception_ptr error;
+
+  auto reader = std::thread{[&] {
+    try {
+      while (true) {
+        auto comic = std::vector<uchar>{};
+        if (!readComic(in, comic)) {
+          break;
+        }
+        std::unique_lock<std::mutex> lock{mutex};
+        changed.wait(lock, [&] { return comics.size() < kReadAhead; });
+        comics.push_back(std::move(comic));
+        changed.notify_all();
+      }
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock{mutex};
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock{mutex};
+    ended = true;
+    changed.notify_all();
+  }};
+
+  for (size_t index = 0;; index++) {
+    auto comic = std::vector<uchar>{};
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      changed.wait(lock, [&] { return !comics.empty() || ended; });
+      if (comics.empty()) {
+        break;
+      }
+      comic = std::move(comics.front());
+      comics.pop_front();
+      changed.notify_all();
+    }
+
+    printComicJson(out, index, transcribe(index, comic));
+    out << std::flush;
+  }
+
+  reader.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void printComicJson(std::ostream& out, size_t index,
+                    const ComicResult& result) {
+  out << "{\"comic\": " << index
+      << ", \"ok\": " << (result.ok ? "true" : "false") << ", \"panels\": [";
+  for (size_t i = 0; i < result.panels.size(); i++) {
+    const auto& panel = result.panels[i];
+    out << (i ? ", " : "") << "{";
+    printRectJson(out, panel.bounds);
+    out << ", \"bubbles\": [";
+    for (size_t j = 0; j < panel.dialog.size(); j++) {
+      const auto& bubble = panel.dialog[j];
+      out << (j ? ", " : "") << "{\"actor\": ";
+      printJsonString(out, bubble.actor);
+      out << ", \"text\": ";
+      printJsonString(out, bubble.contents);
+      out << ", ";
+      printRectJson(out, bubble.bounds);
+      out << "}";
+    }
+    out << "]}";
+  }
+  out << "], ";
+  printStatsMembers(out, result.stats);
+  out << ", \"log\": ";
+  printJsonString(out, result.log);
+  out << "}\n";
+}
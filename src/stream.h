@@ -0,0 +1,31 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+#include "pipeline.h"
+
+// Anything bigger is a framing error rather than a comic
+const uint32_t kMaxComicBytes = 256 << 20;
+
+// Transcribes comics as they arrive on `in`, for running behind another
+// program's pipe. Each comic is a 4 byte big-endian length followed by that
+// many bytes of an encoded image. A thread reads ahead so the next comic is
+// already in memory when the current one is done. Every result is written to
+// `out` as one line of JSON (see printComicJson) and flushed. Returns once
+// `in` ends, throwing if it ends part way through a comic.
+void transcribeStream(
+    std::istream& in, std::ostream& out,
+    std::function<ComicResult(size_t index, const std::vector<uchar>&)>
+        transcribe);
+
+// {"comic": index, "ok": ..., "panels": [{x, y, w, h, "bubbles": [{"actor",
+// "text", x, y, w, h}, ...]}, ...], "ms": {...}, "counts": {...}, "log": ...}
+void printComicJson(std::ostream& out, size_t index,
+                    const ComicResult& result);
+
+#endif
@@ -0,0 +1,437 @@
+#include "actors.h"
+#include "context.h"
+
+#include <functional>
+#include <iostream>
+#include <random>
+
+#include <boost/program_options.hpp>
+
+// Checks that the optimised stages match the reference implementations kept
+// alongside them, on fixture and random inputs, and pins down the actor
+// scoring policy. make test runs it; it exits non-zero if anything differs.
+
+namespace {
+
+void expectSame(const cv::Mat& expected, const cv::Mat& actual,
+                const std::string& what) {
+  if (expected.size() != actual.size() ||
+      (!expected.empty() && cv::norm(expected, actual, cv::NORM_INF) != 0)) {
+    throw std::runtime_error{what + " differs from the reference"};
+  }
+}
+
+std::string describe(const cv::Mat& img) {
+  return std::to_string(img.rows) + "x" + std::to_string(img.cols);
+}
+
+// Mostly line art and background, with some of everything removeBg tells
+// apart: at most 5 is black, at least 250 is white, anything else is grey
+cv::Mat randomWindow(std::mt19937& rng, int rows, int cols) {
+  const uint8_t kBlacks[] = {0, 5};
+  const uint8_t kGreys[] = {6, 127, 249};
+  const uint8_t kWhites[] = {250, 255};
+  const double kGreyness[] = {0.01, 0.1, 0.5};
+
+  auto unit = std::uniform_real_distribution<double>{};
+  const auto greyness = kGreyness[rng() % 3];
+  auto img = cv::Mat{rows, cols, CV_8U};
+  for (auto y = 0; y < rows; y++) {
+    auto row = img.ptr<uint8_t>(y);
+    for (auto x = 0; x < cols; x++) {
+      const auto r = unit(rng);
+      row[x] = r < greyness ? kGreys[rng() % 3]
+                            : r < (1 + greyness) / 2 ? kBlacks[rng() % 2]
+                                                     : kWhites[rng() % 2];
+    }
+  }
+  return img;
+}
+
+// Runs both on copies of `window`, as a view into a larger image so that
+// writing outside of it would show
+void checkRemoveBg(const cv::Mat& window, const std::string& what) {
+  const auto kMargin = 3;
+  const auto kOutside = uint8_t{127};
+
+  auto reference = window.clone();
+  removeBg_Reference_Destructive(reference);
+
+  auto canvas = cv::Mat{window.rows + 2 * kMargin, window.cols + 2 * kMargin,
+                        CV_8U, cv::Scalar{kOutside}};
+  auto bounds = cv::Rect{kMargin, kMargin, window.cols, window.rows};
+  auto view = cv::Mat{canvas, bounds};
+  window.copyTo(view);
+  removeBg_Destructive(view);
+  expectSame(reference, view, "removeBg_Destructive on " + what);
+
+  auto expectedCanvas = cv::Mat{canvas.rows, canvas.cols, CV_8U,
+                                cv::Scalar{kOutside}};
+  auto expectedView = cv::Mat{expectedCanvas, bounds};
+  reference.copyTo(expectedView);
+  expectSame(expectedCanvas, canvas,
+             "removeBg_Destructive around " + what);
+}
+
+void testRemoveBgFixtures(const Models& models) {
+  auto rng = std::mt19937{1};
+  for (const auto& actor : models.actors) {
+    const auto& img = actor.img;
+    checkRemoveBg(img, actor.name);
+
+    // Shaded background, some of it light enough to count as white
+    auto shaded = img.clone();
+    for (auto y = 0; y < shaded.rows; y++) {
+      auto row = shaded.ptr<uint8_t>(y);
+      for (auto x = 0; x < shaded.cols; x++) {
+        if (row[x] >= 250) {
+          row[x] = static_cast<uint8_t>(200 + (x + y) % 56);
+        }
+      }
+    }
+    checkRemoveBg(shaded, actor.name + " on a shaded background");
+
+    // Grey specks, as left by the bubble flood or anti-aliasing
+    auto specked = img.clone();
+    for (auto i = 0; i < img.rows * img.cols / 10; i++) {
+      specked.at<uint8_t>(rng() % img.rows, rng() % img.cols) = 127;
+    }
+    checkRemoveBg(specked, actor.name + " with grey specks");
+  }
+}
+
+void testRemoveBgRandom(const Models&) {
+  auto rng = std::mt19937{2};
+  // Windows one to three rows high or one or two columns wide, where the
+  // filters run off both edges at once
+  for (auto n = 1; n <= 40; n++) {
+    for (auto repeat = 0; repeat < 20; repeat++) {
+      for (auto size : {cv::Size{n, 1}, cv::Size{n, 2}, cv::Size{n, 3},
+                        cv::Size{1, n}, cv::Size{2, n}}) {
+        auto window = randomWindow(rng, size.height, size.width);
+        checkRemoveBg(window, "random " + describe(window));
+      }
+    }
+  }
+  for (auto repeat = 0; repeat < 2000; repeat++) {
+    auto window = randomWindow(rng, 1 + rng() % 64, 1 + rng() % 128);
+    checkRemoveBg(window, "random " + describe(window));
+  }
+  checkRemoveBg(cv::Mat{0, 0, CV_8U}, "an empty window");
+}
+
+// Finds every bubble's tip in turn on one scratch image, whiting out the window
+// under each tip found, as attributeDialog does, with both the BubbleFlood and
+// the reference, and checks they agree after every bubble. `bubbles` are in
+// comic coordinates, like the panel's bounds.
+void checkBubbleFlood(const cv::Mat& panelImg, cv::Rect panelBounds,
+                      const std::vector<cv::Rect>& bubbles,
+                      const std::string& what) {
+  auto img = panelImg.clone();
+  auto reference = panelImg.clone();
+  auto flood = BubbleFlood{img};
+  for (size_t i = 0; i < bubbles.size(); i++) {
+    const auto bubble = what + ", bubble " + std::to_string(i);
+    auto pt = cv::Point{};
+    auto referencePt = cv::Point{};
+    const auto found = flood.tryFindBubbleSource(bubbles[i], panelBounds, pt);
+    const auto referenceFound = tryFindBubbleSource_Reference_Destructive(
+        reference, bubbles[i], panelBounds, referencePt);
+    if (found != referenceFound || (found && pt != referencePt)) {
+      throw std::runtime_error{"BubbleFlood's tip for " + bubble +
+                               " differs from the reference"};
+    }
+    expectSame(reference, img, "BubbleFlood's scratch image after " + bubble);
+
+    if (found) {
+      const auto bounds = actorWindow(pt, panelBounds.size());
+      removeBg_Destructive(cv::Mat{img, bounds});
+      flood.invalidate(bounds);
+      removeBg_Destructive(cv::Mat{reference, bounds});
+    }
+  }
+}
+
+// A panel with a row of bubbles along the top, each with a tail pointing down
+// at `actor` below them
+cv::Mat bubblePanel(const cv::Mat& actor, int count,
+                    std::vector<cv::Rect>& outBubbles) {
+  const auto kMargin = 10;
+  const auto kBubble = cv::Size{60, 30};
+  const auto kTail = 20;
+  const auto kOpening = 6;
+  const auto black = cv::Scalar{0};
+  const auto white = cv::Scalar{255};
+
+  const auto width =
+      std::max(actor.cols, count * (kBubble.width + kMargin)) + 2 * kMargin;
+  const auto height = kMargin + kBubble.height + kTail + actor.rows + kMargin;
+  auto img = cv::Mat{height, width, CV_8U, white};
+  cv::rectangle(img, cv::Rect{0, 0, width, height}, black, 1);
+  auto actorArea = cv::Mat{img, cv::Rect{(width - actor.cols) / 2,
+                                         height - kMargin - actor.rows,
+                                         actor.cols, actor.rows}};
+  actor.copyTo(actorArea);
+
+  for (auto i = 0; i < count; i++) {
+    const auto bounds = cv::Rect{kMargin + i * (kBubble.width + kMargin),
+                                 kMargin, kBubble.width, kBubble.height};
+    cv::rectangle(img, bounds, black, 1);
+    const auto bottom = bounds.y + bounds.height - 1;
+    const auto left = bounds.x + bounds.width / 3;
+    const auto right = left + kOpening;
+    cv::line(img, {left + 1, bottom}, {right - 1, bottom}, white, 1);
+    const auto tip =
+        cv::Point{(left + right) / 2 + (i % 2 ? 8 : -8), bottom + kTail};
+    cv::line(img, {left, bottom}, tip, black, 1);
+    cv::line(img, {right, bottom}, tip, black, 1);
+    outBubbles.push_back(bounds);
+  }
+  return img;
+}
+
+std::vector<cv::Rect> offset(std::vector<cv::Rect> rects, cv::Point by) {
+  for (auto& r : rects) {
+    r.x += by.x;
+    r.y += by.y;
+  }
+  return rects;
+}
+
+void testBubbleFloodFixtures(const Models& models) {
+  const auto kPanelAt = cv::Point{17, 23};
+  for (const auto& actor : models.actors) {
+    for (auto count = 1; count <= 4; count++) {
+      auto bubbles = std::vector<cv::Rect>{};
+      const auto img = bubblePanel(actor.img, count, bubbles);
+      // The first again at the end, when the grey of every flood is there
+      bubbles.push_back(bubbles.front());
+      checkBubbleFlood(img, cv::Rect{kPanelAt, img.size()},
+                       offset(bubbles, kPanelAt),
+                       actor.name + " under " + std::to_string(count) +
+                           " bubbles");
+    }
+  }
+}
+
+// Black outlines and strokes on white, with grey and near black specks
+cv::Mat randomPanel(std::mt19937& rng, int rows, int cols) {
+  auto img = cv::Mat{rows, cols, CV_8U, cv::Scalar{255}};
+  for (auto i = 0; i < rows * cols / 20; i++) {
+    const uint8_t kSpecks[] = {0, 9, 10, 127, 200};
+    img.at<uint8_t>(rng() % rows, rng() % cols) = kSpecks[rng() % 5];
+  }
+  for (auto i = rng() % 10; i > 0; i--) {
+    const auto r = cv::Rect{static_cast<int>(rng() % cols),
+                            static_cast<int>(rng() % rows),
+                            1 + static_cast<int>(rng() % (cols / 2)),
+                            1 + static_cast<int>(rng() % (rows / 2))};
+    cv::rectangle(img, r, cv::Scalar{0}, 1);
+  }
+  for (auto i = rng() % 12; i > 0; i--) {
+    const auto a = cv::Point(rng() % cols, rng() % rows);
+    const auto b = cv::Point(rng() % cols, rng() % rows);
+    cv::line(img, a, b, cv::Scalar(rng() % 2 ? 0 : 127), 1);
+  }
+  return img;
+}
+
+// Whether the reference can flood from this bubble without indexing outside
+// of the panel (see testBubbleFloodLastRow)
+bool inReach(cv::Rect bubble, cv::Rect panelBounds) {
+  const auto minX = bubble.x + bubble.width / 6 - panelBounds.x;
+  const auto maxX = minX + 2 * bubble.width / 3;
+  const auto y = bubble.y + bubble.height / 3 - panelBounds.y;
+  return 0 < minX && maxX < panelBounds.width && 0 < y &&
+         y + 1 < panelBounds.height;
+}
+
+void testBubbleFloodRandom(const Models&) {
+  auto rng = std::mt19937{3};
+  for (auto repeat = 0; repeat < 2000; repeat++) {
+    const auto panelBounds =
+        cv::Rect{static_cast<int>(rng() % 50), static_cast<int>(rng() % 50),
+                 8 + static_cast<int>(rng() % 150),
+                 8 + static_cast<int>(rng() % 150)};
+    const auto img = randomPanel(rng, panelBounds.height, panelBounds.width);
+
+    std::vector<cv::Rect> bubbles;
+    for (auto i = 1 + rng() % 6; i > 0; i--) {
+      const int width = 3 + rng() % (panelBounds.width - 4);
+      const int height = 3 + rng() % (panelBounds.height - 4);
+      auto bubble = cv::Rect{
+          panelBounds.x + static_cast<int>(rng() % (panelBounds.width - width)),
+          panelBounds.y +
+              static_cast<int>(rng() % (panelBounds.height - height)),
+          width, height};
+      // Now and then, one that seeds the second to last row
+      if (rng() % 8 == 0) {
+        bubble.y = panelBounds.y + panelBounds.height - 2 - bubble.height / 3;
+      }
+      if (inReach(bubble, panelBounds)) {
+        bubbles.push_back(bubble);
+      }
+    }
+    checkBubbleFlood(img, panelBounds, bubbles,
+                     "random panel " + std::to_string(repeat));
+  }
+}
+
+// A bubble seeded on the panel's last row has nowhere to bleed to. The
+// reference reads the row below the panel there, so BubbleFlood is checked
+// against what the reference would have done up to that point: grey seeds,
+// and nothing found.
+void testBubbleFloodLastRow(const Models&) {
+  auto rng = std::mt19937{4};
+  for (auto repeat = 0; repeat < 200; repeat++) {
+    const auto panelBounds =
+        cv::Rect{5, 7, 16 + static_cast<int>(rng() % 100),
+                 8 + static_cast<int>(rng() % 100)};
+    const auto img = randomPanel(rng, panelBounds.height, panelBounds.width);
+    auto scratch = img.clone();
+    auto flood = BubbleFlood{scratch};
+
+    const auto width = 6 + static_cast<int>(rng() % (panelBounds.width - 8));
+    const auto height = 3 + static_cast<int>(rng() % 6);
+    const auto bubble = cv::Rect{panelBounds.x + 1,
+                                 panelBounds.y + panelBounds.height - 1 -
+                                     height / 3,
+                                 width, height};
+    auto pt = cv::Point{};
+    if (flood.tryFindBubbleSource(bubble, panelBounds, pt)) {
+      throw std::runtime_error{"BubbleFlood found a tip below the panel"};
+    }
+
+    auto expected = img.clone();
+    const auto minX = bubble.x + bubble.width / 6 - panelBounds.x;
+    auto* last = expected.ptr<uint8_t>(panelBounds.height - 1);
+    for (auto x = minX; x <= minX + 2 * bubble.width / 3; x++) {
+      if (last[x] >= 10) {
+        last[x] = 127;
+      }
+    }
+    expectSame(expected, scratch,
+               "BubbleFlood's last row seeds in panel " +
+                   std::to_string(repeat));
+  }
+}
+
+void expectScore(const ActorScoring& scoring,
+                 const std::vector<float>& distances, size_t descriptors,
+                 double expected, const std::string& what) {
+  const auto score = scoreActor(scoring, distances, descriptors);
+  if (std::abs(score - expected) > 1e-9) {
+    throw std::runtime_error{"scoreActor " + what + " scored " +
+                             std::to_string(score) + ", not " +
+                             std::to_string(expected)};
+  }
+}
+
+void testScoreActor(const Models&) {
+  const auto scoring = ActorScoring{};  // ratio 3, distances 0.5 to 150
+  const auto rejected = -1.0;
+
+  expectScore(scoring, {}, 10, rejected, "with no matches");
+  expectScore(scoring, {1, 1}, 0, rejected, "of an empty template");
+
+  // Good means within three times the best distance
+  expectScore(scoring, {10, 30, 31}, 10, 0.2, "at the distance ratio");
+  expectScore(scoring, {10, 29, 30, 31, 90}, 10, 0.3, "with some past the ratio");
+  // ... but never closer than minGoodDistance or further than maxGoodDistance
+  expectScore(scoring, {0, 0.5f, 0.6f}, 10, 0.2, "with a perfect match");
+  expectScore(scoring, {100, 150, 151, 300}, 10, 0.2, "with a poor best");
+
+  // At least minGoodMatches good ones
+  expectScore(scoring, {10}, 10, rejected, "with one match");
+  expectScore(scoring, {10, 100}, 10, rejected, "with one good match");
+  auto lenient = scoring;
+  lenient.minGoodMatches = 1;
+  expectScore(lenient, {10, 100}, 10, 0.1, "with one good match allowed");
+
+  // More than 2% of the template's descriptors
+  expectScore(scoring, {10, 10}, 100, rejected, "on 2% of the template");
+  expectScore(scoring, {10, 10}, 99, 2.0 / 99, "on just over 2%");
+  auto strict = scoring;
+  strict.minScore = 0.5;
+  expectScore(strict, {10, 10, 10}, 6, rejected, "at a raised minScore");
+}
+
+// The actor templates themselves, and each in a window as attributeDialog
+// would cut it out, named by one search of the whole library and by matching
+// every template on its own
+void testVoteForActor(const Models& models) {
+  const auto kWindow = cv::Size{128, 140};
+
+  const auto sift = makeSiftActorRecognizer(models);
+  const auto reference = makeReferenceSiftActorRecognizer(models);
+  auto differences = std::string{};
+  for (const auto& actor : models.actors) {
+    auto window =
+        cv::Mat{std::max(kWindow.height, actor.img.rows),
+                std::max(kWindow.width, actor.img.cols), CV_8U,
+                cv::Scalar{255}};
+    auto placed = cv::Mat{window, cv::Rect{(window.cols - actor.img.cols) / 2,
+                                           0, actor.img.cols,
+                                           actor.img.rows}};
+    actor.img.copyTo(placed);
+
+    for (const auto& img : {actor.img, window}) {
+      const auto found = sift->findActor(img);
+      const auto expected = reference->findActor(img);
+      if (found != expected) {
+        differences += " " + actor.name + " (" + describe(img) + "): " +
+                       found + " not " + expected + ";";
+      }
+    }
+  }
+  if (!differences.empty()) {
+    throw std::runtime_error{"the sift vote differs from sift-reference on" +
+                             differences};
+  }
+}
+
+const std::pair<const char*, std::function<void(const Models&)>> kTests[] = {
+    {"removeBg/fixtures", testRemoveBgFixtures},
+    {"removeBg/random", testRemoveBgRandom},
+    {"BubbleFlood/fixtures", testBubbleFloodFixtures},
+    {"BubbleFlood/random", testBubbleFloodRandom},
+    {"BubbleFlood/lastRow", testBubbleFloodLastRow},
+    {"scoreActor", testScoreActor},
+    {"voteForActor/sift", testVoteForActor},
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = po::options_description{"Allowed options"};
+  desc.add_options()("help", "this message")(
+      "models", po::value<std::string>(),
+      "model bundle built by jerkcity-pack, whose actor templates are the "
+      "fixtures");
+
+  auto vm = po::variables_map{};
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help")) {
+    std::cout << desc << "\n";
+    return -1;
+  }
+
+  const auto models =
+      loadModels(vm.count("models") ? vm["models"].as<std::string>() : "");
+
+  auto failures = 0;
+  for (const auto& test : kTests) {
+    try {
+      test.second(models);
+      std::cout << "ok   " << test.first << "\n";
+    }
+    catch (const std::exception& e) {
+      std::cout << "FAIL " << test.first << ": " << e.what() << "\n";
+      failures++;
+    }
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -1,150 +1,151 @@
-#include "context.h"
+#include "untypeset.h"
+
+#include "glyphmatch.h"
+#include "pool.h"
+#include "rectgrid.h"
 
 #include <fstream>
 
 #include <boost/algorithm/string/replace.hpp>
 
-// A CharBox is a node in an intrusive doubly-linked list
-struct CharBox {
-  char ch;
-  float score = FLT_MAX;  // 0 is a perfect match, score is positive
-  cv::Rect bounds;
-  bool wordBoundary = false;  // Is this node at the end of a word? (i.e. does
-                              // it need a space after it when derasterizing?)
-  CharBox* next = nullptr;
-  CharBox* prev = nullptr;
-  size_t id;  // unique id for keeping track of things in debug output
-};
-
-// A StrBox points to the start and end of a CharBox list. It also caches the
-// bounding rect for the entire list.
-struct StrBox {
-  StrBox(CharBox* first_, CharBox* last_, cv::Rect bounds_)
-      : first{first_}, last{last_}, bounds{bounds_} {
-    checkRep();
-  }
-
-  CharBox* first;
-  CharBox* last;
-  cv::Rect bounds;
-
-  void checkRep() const {
-    ASSERT(first != nullptr);
-    ASSERT(last != nullptr);
-    ASSERT(first->prev == nullptr);
-    ASSERT(last->next == nullptr);
-
-    // Make sure last is reachable from first and vice-versa
-    if (first == last) {
-      return;
-    }
-    auto soFar = std::string{first->ch};
-    auto tortoise = first;
-    auto hare = first->next;
-    ASSERT(hare != nullptr);
-    while (1) {
-      // We are maintaining the invariant that everything up to the tortoise has
-      // its prev pointers set correctly.
-
-      if (tortoise == last) {
-        return;
-      }
-
-      // If the tortoise isnt at the end it will only reach the hare if there is
-      // a cycle
-      ASSERT(tortoise != hare, "string so far: " + soFar);
-
-      // Since we aren't at the end, verify that we are linked to the next node
-      // correctly
-      ASSERT(tortoise->next->prev = tortoise, "string so far: " + soFar);
-
-      // Tortoise moves 1 step
-      tortoise = tortoise->next;
-      soFar += tortoise->ch;
-
-      // Hare attempts to move 2 steps forward
-      hare = hare->next ? (hare->next->next ? hare->next->next : hare->next)
-                        : hare;
-    }
-  }
-};
-
-template <class T>
-void checkRep(const std::vector<T>& ts) {
-  for (const auto& t : ts) {
-    t.checkRep();
-  }
-}
-
-std::set<std::string> kWords;
-void loadWords() {
-  std::ifstream fin{"/usr/share/dict/words"};
+std::set<std::string> loadWords(const std::string& pathStr) {
+  std::set<std::string> words;
+  std::ifstream fin{pathStr};
   std::string word;
   while (std::getline(fin, word)) {
     std::transform(word.begin(), word.end(), word.begin(), ::tolower);
-    kWords.insert(word);
+    words.insert(word);
   }
-  kWords.insert({"rands", "cocksucking", "goddamnit"});
+  words.insert({"rands", "cocksucking", "goddamnit"});
+  return words;
 }
 
-void merge(StrBox& a, StrBox& b, bool asWords) {
-  a.last->next = b.first;
-  b.first->prev = a.last;
+GlyphArena::GlyphArena(const std::vector<CharBox>& chars)
+    : wordBoundary(chars.size(), false),
+      next(chars.size(), kNone),
+      prev(chars.size(), kNone) {
+  ASSERT(chars.size() < kNone);
+  for (const auto& box : chars) {
+    ch.push_back(box.ch);
+    bounds.push_back(box.bounds);
+    id.push_back(box.id);
+  }
+}
+
+void merge(GlyphArena& glyphs, StrBox& a, StrBox& b, bool asWords) {
+  glyphs.next[a.last] = b.first;
+  glyphs.prev[b.first] = a.last;
   if (asWords) {
-    ASSERT(!a.last->wordBoundary);
-    ASSERT(!b.last->wordBoundary);
-    a.last->wordBoundary = true;
+    ASSERT(!glyphs.wordBoundary[a.last]);
+    ASSERT(!glyphs.wordBoundary[b.last]);
+    glyphs.wordBoundary[a.last] = true;
   }
   a.last = b.last;
 
   a.bounds = a.bounds | b.bounds;  // union rects
 }
 
-void drawDebugRects(Context& ctx, std::vector<StrBox>& boxes, cv::Scalar c,
-                    int thick) {
+void drawDebugRects(Context& ctx, DebugStage stage,
+                    std::vector<StrBox>& boxes, cv::Scalar c, int thick) {
   if (ctx.debug) {
     for (const auto& box : boxes) {
-      cv::rectangle(ctx.debugImg, box.bounds, c, thick);
+      ctx.overlay.rect(stage, box.bounds, c, thick);
     }
   }
 }
 
-void drawDebugArrow(Context& ctx, CharBox* a, CharBox* b, cv::Scalar c) {
-  int ax = a->bounds.x + a->bounds.width / 2;
-  int ay = a->bounds.y + a->bounds.height / 2;
-  int bx = b->bounds.x + b->bounds.width / 2;
-  int by = b->bounds.y + b->bounds.height / 2;
+void drawDebugArrow(Context& ctx, DebugStage stage, const cv::Rect& a,
+                    const cv::Rect& b, cv::Scalar c) {
+  int ax = a.x + a.width / 2;
+  int ay = a.y + a.height / 2;
+  int bx = b.x + b.width / 2;
+  int by = b.y + b.height / 2;
 
   if (ctx.debug) {
-    cv::line(ctx.debugImg, {ax, ay}, {bx, by}, c, 2, CV_AA);
-    cv::line(ctx.debugImg, {bx, by}, {bx - 3, by + 3}, c, 1, CV_AA);
-    cv::line(ctx.debugImg, {bx, by}, {bx - 3, by - 3}, c, 1, CV_AA);
-    cv::line(ctx.debugImg, {bx - 3, by + 3}, {bx - 3, by - 3}, c, 1, CV_AA);
+    ctx.overlay.line(stage, {ax, ay}, {bx, by}, c, 2, CV_AA);
+    ctx.overlay.line(stage, {bx, by}, {bx - 3, by + 3}, c, 1, CV_AA);
+    ctx.overlay.line(stage, {bx, by}, {bx - 3, by - 3}, c, 1, CV_AA);
+    ctx.overlay.line(stage, {bx - 3, by + 3}, {bx - 3, by - 3}, c, 1, CV_AA);
   }
 }
 
-void printStrBoxDebug(Context& ctx, std::vector<StrBox>& boxes,
-                      const std::string& label) {
+void printStrBoxDebug(Context& ctx, const GlyphArena& glyphs,
+                      std::vector<StrBox>& boxes, const std::string& label) {
   if (!ctx.debugJson) {
     return;
   }
-  std::cerr << "\t\"" << label << "\": [\n";
+  ctx.debugOut << "\t\"" << label << "\": [\n";
   for (const auto& box : boxes) {
-    std::cerr << "\t\t[ ";
-    auto ptr = box.first;
-    do {
-      std::cerr << ptr->id << ", ";
-    } while ((ptr = ptr->next) != nullptr);
-    std::cerr << "],\n";
+    ctx.debugOut << "\t\t[ ";
+    for (auto g = box.first; g != GlyphArena::kNone; g = glyphs.next[g]) {
+      ctx.debugOut << glyphs.id[g] << ", ";
+    }
+    ctx.debugOut << "],\n";
   }
-  std::cerr << "\t],\n";
+  ctx.debugOut << "\t],\n";
 }
 
-template <class F>
-void collect(std::vector<StrBox>& chunks, F attemptToJoin) {
+// The ends of a chunk that it can be joined at. Two chunks can only be joined
+// if the tail of one, grown by the join tolerance, touches the head of the
+// other.
+struct ChunkEnds {
+  cv::Rect head;
+  cv::Rect tail;
+};
+
+// Joins pairs of chunks until no two can be joined. attemptToJoin(i, j) either
+// merges one of the two chunks into the other and returns the index of the one
+// that is gone, or returns -1 without touching anything.
+//
+// The result depends on the order of the joins, which is that of a scan for the
+// first i (and for it the first j) that joins, starting over after every join.
+// Rather than starting over, a queue holds every chunk that might still join
+// something as i. A join only changes what the merged chunk and the chunks with
+// ends near it can join, so those are all that go back in the queue. Partners
+// are looked up by their ends in a spatial hash.
+template <class E, class F>
+void collect(const GlyphArena& glyphs, std::vector<StrBox>& chunks, E ends,
+             cv::Size reach, F attemptToJoin) {
+  const auto kCellSize = cv::Size{16, 16};
+
+  SpatialHash heads{kCellSize};
+  SpatialHash tails{kCellSize};
+  auto file = [&](size_t i) {
+    auto e = ends(chunks[i]);
+    heads.insert(e.head, i);
+    tails.insert(e.tail, i);
+  };
+
+  // Chunks that might be joined onto chunks[i] (and some that can't), in order
+  auto findNear = [&](size_t i, std::vector<size_t>& out) {
+    auto grow = [&](cv::Rect r) {
+      return cv::Rect{r.x - reach.width, r.y - reach.height,
+                      r.width + 2 * reach.width, r.height + 2 * reach.height};
+    };
+    auto e = ends(chunks[i]);
+    out.clear();
+    heads.query(grow(e.tail), out);
+    tails.query(grow(e.head), out);
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+  };
+
+  std::vector<bool> gone(chunks.size(), false);
+  std::set<size_t> pending;
   for (size_t i = 0; i < chunks.size(); i++) {
-    for (size_t j = 0; j < chunks.size(); j++) {
-      if (i == j) {
+    file(i);
+    pending.insert(pending.end(), i);
+  }
+
+  std::vector<size_t> candidates;
+  std::vector<size_t> affected;
+  while (!pending.empty()) {
+    auto i = *pending.begin();
+    pending.erase(pending.begin());
+
+    findNear(i, candidates);
+    for (auto j : candidates) {
+      if (j == i || gone[j]) {
         continue;
       }
 
@@ -153,42 +154,56 @@ void collect(std::vector<StrBox>& chunks, F attemptToJoin) {
         continue;
       }
 
-      chunks[(size_t)which == i ? j : i].checkRep();
-
-      chunks.erase(chunks.begin() + which);
+      auto kept = (size_t)which == i ? j : i;
+      chunks[kept].checkRep(glyphs);
+      gone[which] = true;
+      pending.erase(which);
+
+      file(kept);
+      pending.insert(kept);
+      findNear(kept, affected);
+      for (auto k : affected) {
+        if (!gone[k]) {
+          pending.insert(k);
+        }
+      }
+      break;
+    }
+  }
 
-      // restart the process
-      i = 0;
-      j = -1;
+  size_t count = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    if (!gone[i]) {
+      chunks[count++] = chunks[i];
     }
   }
+  chunks.erase(chunks.begin() + count, chunks.end());
 }
 
-auto horizCollector(Context& ctx, std::vector<StrBox>& elems,
-                    const int kXSpacing, bool asWords, cv::Scalar debugColor) {
-  return [=, &ctx, &elems](int i, int j) {
-    const auto kYSpacing = 3;
-
-    CharBox* endOfA = elems[i].last;
-    CharBox* startOfB = elems[j].first;
+auto horizCollector(Context& ctx, GlyphArena& glyphs,
+                    std::vector<StrBox>& elems, const int kXSpacing,
+                    const int kYSpacing, bool asWords, cv::Scalar debugColor) {
+  return [=, &ctx, &glyphs, &elems](int i, int j) {
+    const cv::Rect* endOfA = &glyphs.bounds[elems[i].last];
+    const cv::Rect* startOfB = &glyphs.bounds[elems[j].first];
 
     // Force 'a' to be to the left of 'b'
-    if (endOfA->bounds.x > startOfB->bounds.x) {
+    if (endOfA->x > startOfB->x) {
       std::swap(i, j);
-      endOfA = elems[i].last;
-      startOfB = elems[j].first;
+      endOfA = &glyphs.bounds[elems[i].last];
+      startOfB = &glyphs.bounds[elems[j].first];
     }
 
     auto& a = elems[i];
     auto& b = elems[j];
 
     // Point on 'a' is on the middle of the right edge
-    auto ax = endOfA->bounds.x + endOfA->bounds.width;
-    auto ay = endOfA->bounds.y + endOfA->bounds.height / 2;
+    auto ax = endOfA->x + endOfA->width;
+    auto ay = endOfA->y + endOfA->height / 2;
 
     // Point on 'b' is on the middle of the left edge
-    auto bx = startOfB->bounds.x;
-    auto by = startOfB->bounds.y + startOfB->bounds.height / 2;
+    auto bx = startOfB->x;
+    auto by = startOfB->y + startOfB->height / 2;
 
     auto xDist = std::abs(bx - ax);  // abs because chars can slightly penetrate
     auto yDist = std::abs(by - ay);
@@ -197,26 +212,48 @@ auto horizCollector(Context& ctx, std::vector<StrBox>& elems,
       return -1;
     }
 
-    drawDebugArrow(ctx, a.last, b.first, debugColor);
-    merge(a, b, asWords);
+    // Joining chars makes words, joining words makes lines
+    drawDebugArrow(ctx, asWords ? DebugStage::Lines : DebugStage::Words,
+                   *endOfA, *startOfB, debugColor);
+    merge(glyphs, a, b, asWords);
 
     return j;
   };
 }
 
-void collectWords(Context& ctx, std::vector<StrBox>& chars) {
+// Joins chunks that follow each other on a line
+void collectHoriz(Context& ctx, GlyphArena& glyphs, std::vector<StrBox>& elems,
+                  const int kXSpacing, bool asWords, cv::Scalar debugColor) {
+  const auto kYSpacing = 3;
+
+  // The same points horizCollector measures between
+  auto ends = [&](const StrBox& box) {
+    const auto& first = glyphs.bounds[box.first];
+    const auto& last = glyphs.bounds[box.last];
+    return ChunkEnds{
+        {first.x, first.y + first.height / 2, 1, 1},
+        {last.x + last.width, last.y + last.height / 2, 1, 1}};
+  };
+
+  collect(glyphs, elems, ends, {kXSpacing, kYSpacing},
+          horizCollector(ctx, glyphs, elems, kXSpacing, kYSpacing, asWords,
+                         debugColor));
+}
+
+void collectWords(Context& ctx, GlyphArena& glyphs,
+                  std::vector<StrBox>& chars) {
   const auto kIntraWordXSpacing = 3;
-  collect(chars, horizCollector(ctx, chars, kIntraWordXSpacing, false,
-                                {255, 127, 127}));
+  collectHoriz(ctx, glyphs, chars, kIntraWordXSpacing, false,
+               {255, 127, 127});
 }
 
-void collectLines(Context& ctx, std::vector<StrBox>& words) {
+void collectLines(Context& ctx, GlyphArena& glyphs,
+                  std::vector<StrBox>& words) {
   const auto kInterWordXSpacing = 14;
   const auto debugColor = cv::Scalar{127, 255, 127};
-  collect(words,
-          horizCollector(ctx, words, kInterWordXSpacing, true, debugColor));
+  collectHoriz(ctx, glyphs, words, kInterWordXSpacing, true, debugColor);
 
-  drawDebugRects(ctx, words, {255, 127, 255}, 2);
+  drawDebugRects(ctx, DebugStage::Lines, words, {255, 127, 255}, 2);
 }
 
 bool intervalIntersects(int a0, int a1, int b0, int b1) {
@@ -227,32 +264,62 @@ bool intervalIntersects(int a0, int a1, int b0, int b1) {
   }
 }
 
-std::string getBoundaryWord(StrBox a, bool forward) {
-  auto ptr = forward ? a.first : a.last;
-  std::string str;
-  ASSERT(ptr != nullptr);
-  while (ptr != nullptr) {
-    if (forward) {
-      str = str + ptr->ch;
-      if (ptr->wordBoundary) {
-        break;
-      }
-      ptr = ptr->next;
-    } else {
-      if (ptr->wordBoundary) {
-        break;
-      }
-      str = ptr->ch + str; // hurt me plenty!
-      ptr = ptr->prev;
-    }
+// Walks the chars of a list of glyphs, up to but not including the glyph of
+// the end iterator
+struct CharIterator {
+  const GlyphArena* glyphs;
+  uint32_t glyph;
+
+  char operator*() const { return glyphs->ch[glyph]; }
+  CharIterator& operator++() {
+    glyph = glyphs->next[glyph];
+    return *this;
+  }
+  bool operator==(const CharIterator& other) const {
+    return glyph == other.glyph;
+  }
+  bool operator!=(const CharIterator& other) const {
+    return glyph != other.glyph;
   }
-  std::transform(str.begin(), str.end(), str.begin(), ::tolower);
-  return str;
+};
+
+using CharRange = std::pair<CharIterator, CharIterator>;
+
+// The word at the start of a StrBox, up to and including the first char with a
+// word boundary
+CharRange firstWord(const GlyphArena& glyphs, const StrBox& a) {
+  auto end = a.first;
+  while (end != GlyphArena::kNone && !glyphs.wordBoundary[end]) {
+    end = glyphs.next[end];
+  }
+  return {{&glyphs, a.first},
+          {&glyphs, end != GlyphArena::kNone ? glyphs.next[end] : end}};
+}
+
+// The word at the end of a StrBox, everything after its last word boundary
+CharRange lastWord(const GlyphArena& glyphs, const StrBox& a) {
+  ASSERT(!glyphs.wordBoundary[a.last]);
+  auto start = a.last;
+  while (glyphs.prev[start] != GlyphArena::kNone &&
+         !glyphs.wordBoundary[glyphs.prev[start]]) {
+    start = glyphs.prev[start];
+  }
+  return {{&glyphs, start}, {&glyphs, glyphs.next[a.last]}};
 }
 
-void collectBubbles(Context& ctx, std::vector<StrBox>& lines) {
+void collectBubbles(Context& ctx, GlyphArena& glyphs,
+                    std::vector<StrBox>& lines) {
   const auto kInterLineSpacing = 5;
-  collect(lines, [&](int i, int j) {
+  const auto& words = ctx.models.words;
+
+  // A line's top edge can be joined onto another's bottom edge
+  auto ends = [](const StrBox& box) {
+    const auto& r = box.bounds;
+    return ChunkEnds{{r.x, r.y, r.width, 1},
+                     {r.x, r.y + r.height, r.width, 1}};
+  };
+
+  collect(glyphs, lines, ends, {0, kInterLineSpacing}, [&](int i, int j) {
 
     // Make lines[i] be above lines[j]
     if (lines[i].bounds.y > lines[j].bounds.y) {
@@ -270,27 +337,27 @@ void collectBubbles(Context& ctx, std::vector<StrBox>& lines) {
     }
 
     // Hack: Long strings like "HGHLGUHGLHGUHLUGHGLGHU" get split midway through - don't insert a space if this looks to be the case
-    auto wordA = getBoundaryWord(a, false);
-    auto wordB = getBoundaryWord(b, true);
-    auto lastCh = *(wordA.end() - 1);
+    auto wordA = lastWord(glyphs, a);
+    auto wordB = firstWord(glyphs, b);
+    auto lastCh = glyphs.ch[a.last];
 
-    auto asWords = kWords.find(wordA) != kWords.end()
-                || kWords.find(wordB) != kWords.end()
+    auto asWords = words.contains(wordA.first, wordA.second)
+                || words.contains(wordB.first, wordB.second)
                 || lastCh == '.'
                 || lastCh == ',';
 
-    merge(a, b, asWords);
+    merge(glyphs, a, b, asWords);
 
     return j;
   });
 
-  drawDebugRects(ctx, lines, {127, 255, 255}, 2);
+  drawDebugRects(ctx, DebugStage::Bubbles, lines, {127, 255, 255}, 2);
 }
 
-std::vector<StrBox> initStrBoxes(std::vector<CharBox>& charBoxes) {
+std::vector<StrBox> initStrBoxes(const GlyphArena& glyphs) {
   std::vector<StrBox> result;
-  for (auto& box : charBoxes) {
-    result.emplace_back(&box, &box, box.bounds);
+  for (uint32_t g = 0; g < glyphs.ch.size(); g++) {
+    result.emplace_back(g, g, glyphs.bounds[g]);
   }
   return result;
 }
@@ -298,7 +365,8 @@ std::vector<StrBox> initStrBoxes(std::vector<CharBox>& charBoxes) {
 // Sometimes we may pick up "garbage" lines - i.e. glyphs will be recognized in
 // the background
 // (usually punctuation.) This function removes them from the line list.
-void filterGarbageLines(Context& ctx, std::vector<StrBox>& lines) {
+void filterGarbageLines(Context& ctx, const GlyphArena& glyphs,
+                        std::vector<StrBox>& lines) {
   const size_t kMaxSuspiciousLength = 3;
 
   for (int i = 0; i < (int)lines.size(); i++) {
@@ -306,9 +374,9 @@ void filterGarbageLines(Context& ctx, std::vector<StrBox>& lines) {
     auto& L = lines[i];
 
     size_t questionableChars = 0;
-    CharBox* ptr = L.first;
+    auto g = L.first;
     do {
-      switch (ptr->ch) {
+      switch (glyphs.ch[g]) {
         case '-':
         case '_':
         case '.':
@@ -328,20 +396,23 @@ void filterGarbageLines(Context& ctx, std::vector<StrBox>& lines) {
         case '*':
           questionableChars++;
       }
-    } while ((ptr = ptr->next) != nullptr && ++length <= kMaxSuspiciousLength);
+    } while ((g = glyphs.next[g]) != GlyphArena::kNone &&
+             ++length <= kMaxSuspiciousLength);
 
     if (length > kMaxSuspiciousLength || questionableChars != length + 1) {
       continue;
     }
 
     if (ctx.debug) {
-      cv::rectangle(ctx.debugImg, L.bounds, {255, 255, 255}, CV_FILLED);
-      cv::line(ctx.debugImg, {L.bounds.x, L.bounds.y},
-               {L.bounds.x + L.bounds.width, L.bounds.y + L.bounds.height},
-               {0, 0, 255}, 2, CV_AA);
-      cv::line(ctx.debugImg, {L.bounds.x, L.bounds.y + L.bounds.height},
-               {L.bounds.x + L.bounds.width, L.bounds.y}, {0, 0, 255}, 2,
-               CV_AA);
+      const auto stage = DebugStage::GarbageLines;
+      ctx.overlay.rect(stage, L.bounds, {255, 255, 255}, CV_FILLED);
+      ctx.overlay.line(
+          stage, {L.bounds.x, L.bounds.y},
+          {L.bounds.x + L.bounds.width, L.bounds.y + L.bounds.height},
+          {0, 0, 255}, 2, CV_AA);
+      ctx.overlay.line(stage, {L.bounds.x, L.bounds.y + L.bounds.height},
+                       {L.bounds.x + L.bounds.width, L.bounds.y},
+                       {0, 0, 255}, 2, CV_AA);
     }
 
     lines.erase(lines.begin() + i);
@@ -362,55 +433,107 @@ bool glyphsConflict(std::vector<CharBox>& chars, int i, int j) {
          intArea / jArea > kMaxOverlapAreaRatio;
 }
 
+// Removes the worse of every pair of overlapping glyphs. Conflicts are
+// resolved in the order the old all-pairs scan found them: the earliest glyph
+// with any conflict against its earliest conflicting partner, then again. A
+// glyph that got through that without conflicts can't gain one later (glyphs
+// only ever get removed), so this is one pass over the glyphs, each checked
+// against its neighbours in the order they were found. The loser of a tie is
+// the earlier glyph.
 void filterConflictingGlyphs(Context& ctx, std::vector<CharBox>& chars) {
   if (ctx.debugJson) {
-    std::cerr << "\t\"garbageGlyphs\": [\n";
+    ctx.debugOut << "\t\"garbageGlyphs\": [\n";
   }
 
-  for (auto i = 0; i < (int)chars.size(); i++) {
-    for (auto j = 0; j < (int)chars.size(); j++) {
-      if (i == j) {
-        continue;
-      }
+  std::vector<cv::Rect> bounds;
+  auto cellSize = 1;
+  for (const auto& ch : chars) {
+    bounds.push_back(ch.bounds);
+    cellSize = std::max({cellSize, ch.bounds.width, ch.bounds.height});
+  }
+  const auto grid = RectGrid{bounds, cellSize};
 
-      if (!glyphsConflict(chars, i, j)) {
+  std::vector<bool> dead(chars.size(), false);
+  std::vector<size_t> neighbours;
+  for (size_t i = 0; i < chars.size(); i++) {
+    if (dead[i]) {
+      continue;
+    }
+
+    grid.query(chars[i].bounds, neighbours);
+    for (auto j : neighbours) {
+      if (j == i || dead[j] || !glyphsConflict(chars, i, j)) {
         continue;
       }
 
       auto killIndex = chars[i].score < chars[j].score ? j : i;
       if (ctx.debugJson) {
-        std::cerr << "\t\t" << chars[killIndex].id << ",\n";
+        ctx.debugOut << "\t\t" << chars[killIndex].id << ",\n";
       }
-      chars.erase(chars.begin() + killIndex);
+      dead[killIndex] = true;
+      if (killIndex == i) {
+        break;
+      }
+    }
+  }
 
-      i = 0;
-      j = -1;
+  size_t kept = 0;
+  for (size_t i = 0; i < chars.size(); i++) {
+    if (!dead[i]) {
+      chars[kept++] = chars[i];
     }
   }
+  chars.resize(kept);
 
   if (ctx.debugJson) {
-    std::cerr << "\t],\n";
+    ctx.debugOut << "\t],\n";
   }
 }
 
-int getCredibleMatch(cv::Mat matchAtlas, int startIndex, cv::Rect& match,
-                     float& score) {
-  const float kCharMatchThresh = 100000.0;
+// Finds every instance of a single glyph within the given regions, in the
+// order a scan over the whole image would find them
+std::vector<CharBox> matchGlyph(const GlyphMatcher& matcher,
+                                const std::vector<Template>& templates,
+                                size_t tmplIndex,
+                                const std::vector<cv::Rect>& regions,
+                                size_t maxChars) {
+  const auto& tmpl = templates[tmplIndex];
+  std::vector<CharBox> results;
+
+  ASSERT(tmpl.name.size() == 1);
 
-  const int width = matchAtlas.size().width;
-  const int height = matchAtlas.size().height;
+  CharBox ch;
+  ch.ch = tmpl.name[0];
 
-  auto data = reinterpret_cast<float*>(matchAtlas.data);
+  for (size_t r = 0; r < regions.size(); r++) {
+    const auto& region = regions[r];
+    if (region.width < tmpl.img.cols || region.height < tmpl.img.rows) {
+      continue;
+    }
 
-  for (int i = startIndex; i < width * height; i++) {
-    if (data[i] < kCharMatchThresh) {
-      match.x = i % width;
-      match.y = i / width;
-      score = data[i];
-      return startIndex + match.width - 1;
+    if (results.size() >= maxChars) {
+      break;
     }
+
+    auto matchAtlas = matcher.match(tmplIndex, r);
+    forEachCredibleMatch(matchAtlas, tmpl.img.size(),
+                         [&](int x, int y, float score) {
+      auto found = ch;
+      found.bounds = cv::Rect{{region.x + x, region.y + y}, tmpl.img.size()};
+      found.score = score;
+      results.push_back(found);
+      return results.size() < maxChars;
+    });
   }
-  return -1;
+
+  // Regions are disjoint, so putting matches back in raster order gives the
+  // same list as scanning the whole image would
+  std::stable_sort(results.begin(), results.end(),
+                   [](const CharBox& a, const CharBox& b) {
+    return std::tie(a.bounds.y, a.bounds.x) < std::tie(b.bounds.y, b.bounds.x);
+  });
+
+  return results;
 }
 
 std::vector<CharBox> findGlyphs(Context& ctx,
@@ -418,66 +541,70 @@ std::vector<CharBox> findGlyphs(Context& ctx,
   const size_t kMaxChars = 5000;  // This catches bugs that result in infinite
                                   // loops/going nuts with detection
 
-  std::vector<CharBox> results;
+  // Templates are independent of each other, so they can be matched in any
+  // order (or all at once)...
+  auto matcher = makeGlyphMatcher(ctx.matchEngine, ctx.img, ctx.textRegions,
+                                  ctx.models);
 
-  if (ctx.debugJson) {
-    std::cerr << "\t\"chars\": [\n";
+  std::vector<std::vector<CharBox>> matches(templates.size());
+  auto matchOne = [&](size_t i) {
+    matches[i] =
+        matchGlyph(*matcher, templates, i, ctx.textRegions, kMaxChars);
+  };
+  if (ctx.pool) {
+    ctx.pool->parallelFor(templates.size(), matchOne);
+  } else {
+    for (size_t i = 0; i < templates.size(); i++) {
+      matchOne(i);
+    }
   }
 
-  CharBox ch;
-  ch.id = 0;
-
-  for (auto&& tmpl : templates) {
-    auto matchAtlas = cv::Mat(
-        cv::Size(ctx.img.size().width, ctx.img.size().height), CV_32F, 1);
-    cv::matchTemplate(ctx.img, tmpl.img, matchAtlas, CV_TM_SQDIFF);
+  // ...but are merged in template order so ids come out as in a serial run
+  std::vector<CharBox> results;
 
-    ASSERT(tmpl.name.size() == 1);
+  if (ctx.debugJson) {
+    ctx.debugOut << "\t\"chars\": [\n";
+  }
 
-    ch.ch = tmpl.name[0];
-    ch.bounds = cv::Rect{{0, 0}, tmpl.img.size()};
+  size_t id = 0;
+  for (auto&& glyphMatches : matches) {
+    for (auto&& ch : glyphMatches) {
+      if (results.size() >= kMaxChars) {
+        break;
+      }
 
-    // Find all instances of this glyph
-    int index = 0;
-    while ((index = getCredibleMatch(matchAtlas, index, ch.bounds, ch.score)) !=
-               -1 &&
-           results.size() < kMaxChars) {
+      ch.id = id++;
       results.push_back(ch);
-      ch.id++;
 
       if (ctx.debugJson) {
-        std::cerr << "\t\t{ \"ch\": \"" << ch.ch << ", \"id\": " << ch.id
-                  << ", \"score\": " << ch.score << ", ";
-        printRectJson(ch.bounds);
-        std::cerr << " },\n";
+        ctx.debugOut << "\t\t{ \"ch\": \"" << ch.ch << ", \"id\": " << id
+                     << ", \"score\": " << ch.score << ", ";
+        printRectJson(ctx.debugOut, ch.bounds);
+        ctx.debugOut << " },\n";
       }
 
-      // Clear out a ROI around the match we just found
-      cv::rectangle(matchAtlas, ch.bounds, FLT_MAX, CV_FILLED);
       if (ctx.debug) {
-        cv::rectangle(ctx.debugImg, ch.bounds, {0, 0, 0}, CV_FILLED);
+        ctx.overlay.rect(DebugStage::Glyphs, ch.bounds, {0, 0, 0}, CV_FILLED);
       }
     }
-    ASSERT(results.size() <= kMaxChars);
   }
+  ASSERT(results.size() <= kMaxChars);
 
   if (ctx.debugJson) {
-    std::cerr << "\t},\n";
+    ctx.debugOut << "\t},\n";
   }
   return results;
 }
 
-std::string strBoxToString(const StrBox& strBox) {
+std::string strBoxToString(const GlyphArena& glyphs, const StrBox& strBox) {
   std::string result;
 
-  auto ptr = strBox.first;
-
-  do {
-    result += ptr->ch;
-    if (ptr->wordBoundary) {
+  for (auto g = strBox.first; g != GlyphArena::kNone; g = glyphs.next[g]) {
+    result += glyphs.ch[g];
+    if (glyphs.wordBoundary[g]) {
       result += " ";
     }
-  } while ((ptr = ptr->next) != nullptr);
+  }
 
   // Hack: its hard to tell the difference between , and .
   // I've got some ideas on how to handle this better, but this is a pragmatic
@@ -499,9 +626,10 @@ float portionInPanel(const Panel& panel, const StrBox& strBox) {
   return strBoxArea - intersectionArea;
 }
 
-void placeBubblesInPanels(Context& ctx, std::vector<StrBox>& bubbles) {
+void placeBubblesInPanels(Context& ctx, const GlyphArena& glyphs,
+                          std::vector<StrBox>& bubbles) {
   for (auto strBox : bubbles) {
-    auto contents = strBoxToString(strBox);
+    auto contents = strBoxToString(glyphs, strBox);
     auto minSoFar = FLT_MAX;
     auto minIndex = -1;
     for (size_t i = 0; i < ctx.panels.size(); i++) {
@@ -531,33 +659,50 @@ void sortBubblesInPanels(Context& ctx) {
 }
 
 void untypeset(Context& ctx) {
-  loadWords();
-
-  std::vector<CharBox> charBoxes;
+  auto charBoxes = std::vector<CharBox>{};
   {
-    auto glyphs = loadTemplates("glyphs");
-    charBoxes = findGlyphs(ctx, glyphs);
+    ScopedTimer timer{ctx.stats, "untypeset/findGlyphs"};
+    charBoxes = findGlyphs(ctx, ctx.models.glyphs);
   }
-  filterConflictingGlyphs(ctx, charBoxes);
-
-  auto chunks = initStrBoxes(charBoxes);
+  ctx.stats.count("templatesMatched", ctx.models.glyphs.size());
+  ctx.stats.count("candidates", charBoxes.size());
+  {
+    ScopedTimer timer{ctx.stats, "untypeset/filterConflictingGlyphs"};
+    filterConflictingGlyphs(ctx, charBoxes);
+  }
+  ctx.stats.count("glyphs", charBoxes.size());
+
+  auto glyphs = GlyphArena{charBoxes};
+  auto chunks = initStrBoxes(glyphs);
+  checkRep(glyphs, chunks);
+
+  // Each stage only ever merges or removes chunks, so the drop in their number
+  // is the stage's work
+  auto stage = [&](const char* timing, const char* counter, auto collector) {
+    auto before = chunks.size();
+    {
+      ScopedTimer timer{ctx.stats, timing};
+      collector(ctx, glyphs, chunks);
+    }
+    ctx.stats.count(counter, before - chunks.size());
+  };
 
-  collectWords(ctx, chunks);
-  checkRep(chunks);
-  printStrBoxDebug(ctx, chunks, "words");
+  stage("untypeset/collectWords", "wordMerges", collectWords);
+  checkRep(glyphs, chunks);
+  printStrBoxDebug(ctx, glyphs, chunks, "words");
 
-  collectLines(ctx, chunks);
-  checkRep(chunks);
-  printStrBoxDebug(ctx, chunks, "lines");
+  stage("untypeset/collectLines", "lineMerges", collectLines);
+  checkRep(glyphs, chunks);
+  printStrBoxDebug(ctx, glyphs, chunks, "lines");
 
-  filterGarbageLines(ctx, chunks);
-  checkRep(chunks);
-  printStrBoxDebug(ctx, chunks, "filteredLines");
+  stage("untypeset/filterGarbageLines", "garbageLines", filterGarbageLines);
+  checkRep(glyphs, chunks);
+  printStrBoxDebug(ctx, glyphs, chunks, "filteredLines");
 
-  collectBubbles(ctx, chunks);
-  checkRep(chunks);
-  printStrBoxDebug(ctx, chunks, "bubbles");
+  stage("untypeset/collectBubbles", "bubbleMerges", collectBubbles);
+  checkRep(glyphs, chunks);
+  printStrBoxDebug(ctx, glyphs, chunks, "bubbles");
 
-  placeBubblesInPanels(ctx, chunks);
+  placeBubblesInPanels(ctx, glyphs, chunks);
   sortBubblesInPanels(ctx);
 }
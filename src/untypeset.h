@@ -0,0 +1,172 @@
+#ifndef _UNTYPESET_H_
+#define _UNTYPESET_H_
+
+#include "context.h"
+#include "glyphmatch.h"
+
+// A glyph found by matching
+struct CharBox {
+  char ch;
+  float score = FLT_MAX;  // 0 is a perfect match, score is positive
+  cv::Rect bounds;
+  size_t id;  // unique id for keeping track of things in debug output
+};
+
+// Per-comic storage for the glyphs that get assembled into text. Glyphs are
+// referred to by index and strung together by index links, and every field has
+// its own array, so walking or merging strings only touches the links.
+struct GlyphArena {
+  static const uint32_t kNone = UINT32_MAX;
+
+  explicit GlyphArena(const std::vector<CharBox>& chars);
+
+  std::vector<char> ch;
+  std::vector<cv::Rect> bounds;
+  std::vector<size_t> id;
+  std::vector<uint8_t> wordBoundary;  // Is this glyph at the end of a word?
+                                      // (i.e. does it need a space after it
+                                      // when derasterizing?)
+  std::vector<uint32_t> next;
+  std::vector<uint32_t> prev;
+};
+
+// A StrBox points to the start and end of a list of glyphs in a GlyphArena. It
+// also caches the bounding rect for the entire list.
+struct StrBox {
+  StrBox(uint32_t first_, uint32_t last_, cv::Rect bounds_)
+      : first{first_}, last{last_}, bounds{bounds_} {}
+
+  uint32_t first;
+  uint32_t last;
+  cv::Rect bounds;
+
+  void checkRep(const GlyphArena& glyphs) const {
+    if (!kCheckInvariants) {
+      return;
+    }
+
+    ASSERT(first != GlyphArena::kNone);
+    ASSERT(last != GlyphArena::kNone);
+    ASSERT(glyphs.prev[first] == GlyphArena::kNone);
+    ASSERT(glyphs.next[last] == GlyphArena::kNone);
+
+    // Make sure last is reachable from first and vice-versa
+    if (first == last) {
+      return;
+    }
+    auto soFar = std::string{glyphs.ch[first]};
+    auto tortoise = first;
+    auto hare = glyphs.next[first];
+    ASSERT(hare != GlyphArena::kNone);
+    while (1) {
+      // We are maintaining the invariant that everything up to the tortoise has
+      // its prev pointers set correctly.
+
+      if (tortoise == last) {
+        return;
+      }
+
+      // If the tortoise isnt at the end it will only reach the hare if there is
+      // a cycle
+      ASSERT(tortoise != hare, "string so far: " + soFar);
+
+      // Since we aren't at the end, verify that we are linked to the next node
+      // correctly
+      auto next = glyphs.next[tortoise];
+      ASSERT(next != GlyphArena::kNone, "string so far: " + soFar);
+      ASSERT(glyphs.prev[next] == tortoise, "string so far: " + soFar);
+
+      // Tortoise moves 1 step
+      tortoise = next;
+      soFar += glyphs.ch[tortoise];
+
+      // Hare attempts to move 2 steps forward
+      for (int step = 0; step < 2 && glyphs.next[hare] != GlyphArena::kNone;
+           step++) {
+        hare = glyphs.next[hare];
+      }
+    }
+  }
+};
+
+inline void checkRep(const GlyphArena& glyphs,
+                     const std::vector<StrBox>& boxes) {
+  if (!kCheckInvariants) {
+    return;
+  }
+  for (const auto& box : boxes) {
+    box.checkRep(glyphs);
+  }
+}
+
+// Calls found(x, y, score) for every credible match in a match atlas, in raster
+// order. Each match suppresses the template sized box starting at it, so later
+// positions inside it (other hits on the same glyph) aren't reported. This is
+// one pass over the atlas, stopping early if found() returns false.
+template <class F>
+void forEachCredibleMatch(const cv::Mat& matchAtlas, cv::Size tmplSize,
+                          F found) {
+  const int width = matchAtlas.cols;
+
+  // Per column, the first row that no earlier match suppresses. Matches come in
+  // raster order, so this is all that's needed to tell whether a position is
+  // inside an earlier match's box.
+  std::vector<int> freeFromRow(width, 0);
+
+  // Scanning used to restart after every match, each time tmplSize.width - 1
+  // positions further on than the previous restart. That skips a few unclaimed
+  // positions when a match wraps past the end of a row, so keep doing it to
+  // produce the same matches.
+  int64_t resumeAt = 0;
+
+  for (int y = 0; y < matchAtlas.rows; y++) {
+    auto row = matchAtlas.ptr<float>(y);
+
+    // Most rows have nothing under the threshold, and counting vectorizes where
+    // looking for the first hit doesn't
+    int hits = 0;
+    for (int x = 0; x < width; x++) {
+      hits += row[x] < kCharMatchThresh;
+    }
+    if (hits == 0) {
+      continue;
+    }
+
+    for (int x = 0; x < width; x++) {
+      if (!(row[x] < kCharMatchThresh) || y < freeFromRow[x] ||
+          int64_t(y) * width + x < resumeAt) {
+        continue;
+      }
+
+      if (!found(x, y, row[x])) {
+        return;
+      }
+
+      resumeAt += tmplSize.width - 1;
+      for (int sx = x; sx < std::min(width, x + tmplSize.width); sx++) {
+        freeFromRow[sx] = std::max(freeFromRow[sx], y + tmplSize.height);
+      }
+    }
+  }
+}
+
+std::vector<CharBox> matchGlyph(const GlyphMatcher& matcher,
+                                const std::vector<Template>& templates,
+                                size_t tmplIndex,
+                                const std::vector<cv::Rect>& regions,
+                                size_t maxChars);
+std::vector<CharBox> findGlyphs(Context& ctx,
+                                const std::vector<Template>& templates);
+void filterConflictingGlyphs(Context& ctx, std::vector<CharBox>& chars);
+
+// The assembly stages of untypeset, in order. Each merges (or drops) chunks of
+// glyphs, starting from one chunk per glyph.
+std::vector<StrBox> initStrBoxes(const GlyphArena& glyphs);
+void collectWords(Context& ctx, GlyphArena& glyphs, std::vector<StrBox>& chars);
+void collectLines(Context& ctx, GlyphArena& glyphs, std::vector<StrBox>& words);
+void filterGarbageLines(Context& ctx, const GlyphArena& glyphs,
+                        std::vector<StrBox>& lines);
+void collectBubbles(Context& ctx, GlyphArena& glyphs,
+                    std::vector<StrBox>& lines);
+
+#endif
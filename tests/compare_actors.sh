@@ -0,0 +1,22 @@
+#!/bin/bash
+# Runs the regression suite once per actor engine and summarizes each run.
+# Results are left in out-<engine>. ENGINES="sift-reference sift orb" also
+# runs the slow original matcher the others were calibrated against. Each
+# summary is also added to the corpus results in actor_engines.txt.
+
+REVISION=`git rev-parse --short HEAD`
+
+for ENGINE in ${ENGINES:-sift orb}; do
+  START=`date +%s`
+  JERKCITY_FLAGS="--actor-engine=$ENGINE" ./all.sh > /dev/null
+  END=`date +%s`
+  PASS=`grep -c 'background: green' out/index.html`
+  SPEAKER=`grep -c 'background: yellow' out/index.html`
+  FAIL=`grep -c 'background: red' out/index.html`
+  SUMMARY="$ENGINE: $PASS pass, $SPEAKER wrong speaker, $FAIL wrong dialog, $((END - START))s"
+  echo "$SUMMARY"
+  sed -i '/^  (not yet run)$/d' actor_engines.txt
+  echo "  `date +%F` $REVISION $SUMMARY" >> actor_engines.txt
+  rm -rf out-$ENGINE
+  mv out out-$ENGINE
+done
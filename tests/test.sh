@@ -6,14 +6,18 @@ EXPECTED=`echo "$CHUNK" | grep -m1 -A5000 '<dialog>' | tail -n +2 | sed -e 's/&g
 
 echo "<img src=\"http://jerkcity.com/jerkcity$NUM.gif\"><img src=\"$NUM.debug.png\">" > out/$NUM.html
 
-if [ ! -f img/$NUM.png ]; then
-  wget --quiet http://jerkcity.com/jerkcity$NUM.gif
-  convert jerkcity$NUM.gif img/$NUM.png
-  rm jerkcity$NUM.gif
+# jerkcity reads the GIFs as they are published. PNGs converted by older
+# versions of this script are still used where they exist.
+IMG=img/$NUM.png
+if [ ! -f $IMG ]; then
+  IMG=img/$NUM.gif
+  if [ ! -f $IMG ]; then
+    wget --quiet -O $IMG http://jerkcity.com/jerkcity$NUM.gif || rm -f $IMG
+  fi
 fi
 
 cd ../src
-ACTUAL=`nice -n 5 timeout -s 9 10 ./jerkcity --debug-file=../tests/out/$NUM.debug.png --input-file=../tests/img/$NUM.png | sed -e 's/ *$//' -e 's/^ *//'`
+ACTUAL=`nice -n 5 timeout -s 9 10 ./jerkcity $JERKCITY_FLAGS --debug-file=../tests/out/$NUM.debug.png --input-file=../tests/$IMG | sed -e 's/ *$//' -e 's/^ *//'`
 EX=$?
 cd ../tests
 